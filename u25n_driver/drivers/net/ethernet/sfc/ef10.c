@@ -37,6 +37,7 @@
 #include "emcdi.h"
 #include "emcdicaps.h"
 #include "fpgacaps.h"
+#include "u25_rep.h"
 
 #if defined(EFX_USE_KCOMPAT) && !defined(EFX_HAVE_HW_ENC_FEATURES)
 #undef EFX_USE_OVERLAY_TX_CSUM
@@ -1279,13 +1280,47 @@ static int efx_ef10_dimension_resources(struct efx_nic *efx)
 	return 0;
 }
 
+/* U25 representor packets leave through the PF's queues with their
+ * destination mport encoded as two VLAN tags.  Have the hardware insert
+ * them with a VLAN option descriptor, which stays in effect until the next
+ * one, so only a change of destination costs a descriptor.
+ */
+static void efx_ef10_set_tx_queue_mport(struct efx_tx_queue *tx_queue,
+					struct sk_buff *skb)
+{
+	u32 tags = efx_u25_vfrep_tx_tags(skb);
+	struct efx_tx_buffer *buffer;
+
+	if (likely(tx_queue->mport_tags == tags))
+		return;
+
+	buffer = efx_tx_queue_get_insert_buffer(tx_queue);
+	buffer->flags = EFX_TX_BUF_OPTION;
+	buffer->len = buffer->unmap_len = 0;
+	EFX_POPULATE_QWORD_5(buffer->option,
+			     ESF_DZ_TX_DESC_IS_OPT, true,
+			     ESF_DZ_TX_OPTION_TYPE, ESE_DZ_TX_OPTION_DESC_VLAN,
+			     ESF_DZ_TX_VLAN_OP,
+				tags ? ESE_DZ_TX_VLAN_OP_INSERT_TAG1_TAG2 :
+				       ESE_DZ_TX_VLAN_OP_NONE,
+			     ESF_DZ_TX_VLAN_TAG1, tags >> 16,
+			     ESF_DZ_TX_VLAN_TAG2, tags & 0xffff);
+	++tx_queue->insert_count;
+	tx_queue->mport_tags = tags;
+}
+
 #ifdef EFX_NOT_UPSTREAM
 static struct efx_tx_queue *
 efx_ef10_select_tx_queue_non_csum(struct efx_channel *channel,
 				  struct sk_buff *skb)
 {
-	return &channel->tx_queues[skb->ip_summed ? EFX_TXQ_TYPE_CSUM_OFFLOAD :
-						    EFX_TXQ_TYPE_NO_OFFLOAD];
+	struct efx_tx_queue *tx_queue =
+		&channel->tx_queues[skb->ip_summed ? EFX_TXQ_TYPE_CSUM_OFFLOAD :
+						     EFX_TXQ_TYPE_NO_OFFLOAD];
+
+	efx_ef10_set_tx_queue_mport(tx_queue, skb);
+
+	return tx_queue;
 }
 #endif
 
@@ -1332,6 +1367,7 @@ efx_ef10_select_tx_queue(struct efx_channel *channel,
 	struct efx_tx_queue *tx_queue = &channel->tx_queues[0];
 
 	efx_ef10_set_tx_queue_csum(tx_queue, txq_type);
+	efx_ef10_set_tx_queue_mport(tx_queue, skb);
 
 	return tx_queue;
 }
@@ -1377,10 +1413,14 @@ efx_ef10_select_tx_queue_non_csum_overlay(struct efx_channel *channel,
 					  struct sk_buff *skb)
 {
 	unsigned int txq_type = efx_ef10_select_tx_queue_type(skb);
+	struct efx_tx_queue *tx_queue;
 
 	EFX_WARN_ON_PARANOID(txq_type > channel->tx_queue_count);
 
-	return &channel->tx_queues[txq_type];
+	tx_queue = &channel->tx_queues[txq_type];
+	efx_ef10_set_tx_queue_mport(tx_queue, skb);
+
+	return tx_queue;
 }
 #endif
 
@@ -1401,6 +1441,7 @@ efx_ef10_select_tx_queue_overlay(struct efx_channel *channel,
 	struct efx_tx_queue *tx_queue = &channel->tx_queues[txq_map[txq_type]];
 
 	efx_ef10_set_tx_queue_csum(tx_queue, txq_type);
+	efx_ef10_set_tx_queue_mport(tx_queue, skb);
 
 	return tx_queue;
 }
@@ -2762,6 +2803,7 @@ static int efx_ef10_tx_init(struct efx_tx_queue *tx_queue)
 			     ESF_DZ_TX_TIMESTAMP,
 				tx_queue->timestamping);
 	tx_queue->write_count = 1;
+	tx_queue->mport_tags = 0;
 
 	if (tso_v2) {
 		tx_queue->handle_tso = efx_ef10_tx_tso_desc;
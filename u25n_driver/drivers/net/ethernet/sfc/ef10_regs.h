@@ -392,6 +392,22 @@
 #define	ESF_DZ_TX_TSO_OUTER_IPID_LBN 0
 #define	ESF_DZ_TX_TSO_OUTER_IPID_WIDTH 16
 
+/* TX_VLAN_DESC */
+#define	ESF_DZ_TX_DESC_IS_OPT_LBN 63
+#define	ESF_DZ_TX_DESC_IS_OPT_WIDTH 1
+#define	ESF_DZ_TX_OPTION_TYPE_LBN 60
+#define	ESF_DZ_TX_OPTION_TYPE_WIDTH 3
+#define	ESE_DZ_TX_OPTION_DESC_VLAN 6
+#define	ESF_DZ_TX_VLAN_OP_LBN 32
+#define	ESF_DZ_TX_VLAN_OP_WIDTH 2
+#define	ESE_DZ_TX_VLAN_OP_INSERT_TAG1_TAG2 2
+#define	ESE_DZ_TX_VLAN_OP_INSERT_TAG1 1
+#define	ESE_DZ_TX_VLAN_OP_NONE 0
+#define	ESF_DZ_TX_VLAN_TAG2_LBN 16
+#define	ESF_DZ_TX_VLAN_TAG2_WIDTH 16
+#define	ESF_DZ_TX_VLAN_TAG1_LBN 0
+#define	ESF_DZ_TX_VLAN_TAG1_WIDTH 16
+
 /*************************************************************************/
 
 /* TX_DESC_UPD_REG: Transmit descriptor update register.
@@ -362,11 +362,18 @@ int efx_ioctl(struct net_device *net_dev, struct ifreq *ifr, int cmd)
 	}
 #endif
 	if (efx_is_u25(efx) && 
-		((cmd <= IPSEC_OFFLOAD_QUERY_SA) &&
-		(cmd >= IPSEC_OFFLOAD_ADD_SA_ENC )))
+		(((cmd <= IPSEC_OFFLOAD_QUERY_SA) &&
+		(cmd >= IPSEC_OFFLOAD_ADD_SA_ENC )) ||
+		cmd == IPSEC_OFFLOAD_BATCH))
 		return efx_ipsec_ioctl(efx, ifr, cmd);
 
 
+#if (!defined(EFX_USE_KCOMPAT) || defined(EFX_TC_OFFLOAD)) && \
+	LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+	if (efx_is_u25(efx) && cmd == FIREWALL_OPERATION)
+		return efx_legacy_firewall_ioctl(efx, ifr);
+#endif
+
 	/* IOCTL command for image upgrade */
 	if ((efx_is_u25(efx)) && ((cmd >= FPGA_OPERATION) && (cmd <= FLASH_OPERATION))) {
 		return image_upgrade_ioctl_call(efx, ifr, cmd);
@@ -14,6 +14,30 @@ struct efx_vfrep_sw_stats {
 	atomic_t rx_packets, tx_packets;
 	atomic_t rx_bytes, tx_bytes;
 	atomic_t rx_dropped, tx_errors;
+	atomic_t rx_xdp_drops, rx_xdp_bad_drops;
+	atomic_t rx_xdp_tx, rx_xdp_redirect;
+};
+
+/* An RX queue of a multi-queue (U25) representor, fed from one PF channel.
+ * The GRO counters are only written by the queue's NAPI poll.
+ */
+struct efx_vfrep_rxq {
+	struct efx_vfrep *efv;
+	unsigned int write_index, read_index;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
+	struct list_head rx_list;
+#else
+	struct sk_buff_head rx_list;
+#endif
+	spinlock_t rx_lock;
+	struct napi_struct napi;
+	unsigned int n_rx_gro_merged;	/* coalesced into a held packet */
+	unsigned int n_rx_gro_held;	/* started a new GRO packet */
+	unsigned int n_rx_gro_normal;	/* passed up without coalescing */
+	unsigned int n_rx_gro_flushes;	/* NAPI completions flushing GRO */
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_RXQ_INFO)
+	struct xdp_rxq_info xdp_rxq_info;
+#endif
 };
 
 /* Private data for an Efx representor */
@@ -22,6 +46,7 @@ struct efx_vfrep {
 	struct net_device *net_dev;
 	u32 msg_enable;
 	u32 vf_mport; /* m-port ID of corresponding VF */
+	u32 tx_mport_tags; /* VLAN tags inserted by hardware on TX, or 0 */
 	unsigned int vf_idx;
 	unsigned int write_index, read_index;
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
@@ -33,6 +58,13 @@ struct efx_vfrep {
 	struct napi_struct napi;
 	struct efx_vfrep_sw_stats stats;
 	unsigned int channel;
+	/* U25 representors use these instead of the single queue above */
+	struct efx_vfrep_rxq *rxq;
+	unsigned int n_rxq;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP)
+	/* Run on this representor's frames in the PF RX path */
+	struct bpf_prog __rcu *xdp_prog;
+#endif
 };
 
 int efx_void_dummy_op_int(void);
@@ -92,6 +92,147 @@
 #define APP_IN_PS                (11)
 #define FLASH_INDEX              (12)
 #define CHECK_U25                (13)
+#define UPGRADE_STREAM           (14)
+
+/* Batched stateless firewall rule insertion/removal (legacy mode) */
+#define FIREWALL_OPERATION       (SIOCDEVPRIVATE + 12)
+
+#define EFX_FIREWALL_RULE_ADD    (0)
+#define EFX_FIREWALL_RULE_DEL    (1)
+
+#define EFX_FIREWALL_RULE_ACTION_DROP   0x00
+#define EFX_FIREWALL_RULE_ACTION_ACCEPT 0xff
+
+/* Maximum number of rules accepted by a single FIREWALL_OPERATION call */
+#define EFX_FIREWALL_BATCH_MAX   1024
+
+/**
+ * struct efx_firewall_rule - one rule in a %FIREWALL_OPERATION request
+ * @cookie: Caller-chosen identifier, used to remove the rule later
+ * @rc: Result for this rule (0 or a negative errno), filled in by the driver
+ * @action: %EFX_FIREWALL_RULE_ACTION_DROP or %EFX_FIREWALL_RULE_ACTION_ACCEPT
+ * @ip_proto: IP protocol to match; @ip_proto_mask selects the bits used
+ * @eth_proto: Ethertype (network order); selects which addresses are used
+ * @sport: L4 source port (network order), masked by @sport_mask
+ * @dport: L4 destination port (network order), masked by @dport_mask
+ * @src_ip: IPv4 source address, masked by @src_ip_mask
+ * @dst_ip: IPv4 destination address, masked by @dst_ip_mask
+ * @src_ip6: IPv6 source address, masked by @src_ip6_mask
+ * @dst_ip6: IPv6 destination address, masked by @dst_ip6_mask
+ *
+ * Only @cookie is used for %EFX_FIREWALL_RULE_DEL.
+ */
+struct efx_firewall_rule {
+	__u64 cookie;
+	__s32 rc;
+	__u8 action;
+	__u8 ip_proto;
+	__u8 ip_proto_mask;
+	__u8 reserved;
+	__be16 eth_proto;
+	__be16 sport;
+	__be16 sport_mask;
+	__be16 dport;
+	__be16 dport_mask;
+	__be32 src_ip;
+	__be32 src_ip_mask;
+	__be32 dst_ip;
+	__be32 dst_ip_mask;
+	__u8 src_ip6[16];
+	__u8 src_ip6_mask[16];
+	__u8 dst_ip6[16];
+	__u8 dst_ip6_mask[16];
+};
+
+/**
+ * struct efx_firewall_rule_batch - header of a %FIREWALL_OPERATION request
+ * @op: %EFX_FIREWALL_RULE_ADD or %EFX_FIREWALL_RULE_DEL
+ * @count: Number of entries in @rules, at most %EFX_FIREWALL_BATCH_MAX
+ * @rules: The rules; each entry's @rc is written back on return
+ */
+struct efx_firewall_rule_batch {
+	__u32 op;
+	__u32 count;
+	struct efx_firewall_rule rules[];
+};
+
+/* Several IPsec SA installs/removals in one call */
+#define IPSEC_OFFLOAD_BATCH      (SIOCDEVPRIVATE + 13)
+
+/* Maximum number of entries accepted by a single IPSEC_OFFLOAD_BATCH call */
+#define EFX_IPSEC_BATCH_MAX      256
+
+/* Room for the request of any single IPSEC_OFFLOAD_* SA ioctl */
+#define EFX_IPSEC_BATCH_SA_LEN   72
+
+/**
+ * struct efx_ipsec_batch_entry - one SA operation in an %IPSEC_OFFLOAD_BATCH
+ * @op: %IPSEC_OFFLOAD_ADD_SA_ENC, %IPSEC_OFFLOAD_ADD_SA_DEC,
+ *	%IPSEC_OFFLOAD_DEL_SA_ENC or %IPSEC_OFFLOAD_DEL_SA_DEC
+ * @rc: Result for this entry (0 or a negative errno), filled in by the driver
+ * @sa: The request that ioctl takes on its own
+ */
+struct efx_ipsec_batch_entry {
+	__u32 op;
+	__s32 rc;
+	__u8 sa[EFX_IPSEC_BATCH_SA_LEN] __aligned(8);
+};
+
+/**
+ * struct efx_ipsec_batch - header of an %IPSEC_OFFLOAD_BATCH request
+ * @count: Number of entries in @entries, at most %EFX_IPSEC_BATCH_MAX
+ * @reserved: Must be zero
+ * @entries: The operations.  They are sent in order, but only an entry for
+ *	the same source and destination contexts as an earlier one is sure to
+ *	take effect after it
+ */
+struct efx_ipsec_batch {
+	__u32 count;
+	__u32 reserved;
+	struct efx_ipsec_batch_entry entries[];
+};
+
+#define EFX_IPSEC_SA_STATS_ENCRYPT	0x1
+
+/**
+ * struct efx_ipsec_sa_stats - hardware counters of one offloaded IPsec SA
+ * @spi: SPI, as passed to %IPSEC_OFFLOAD_ADD_SA_ENC or %IPSEC_OFFLOAD_ADD_SA_DEC
+ * @flags: %EFX_IPSEC_SA_STATS_ENCRYPT for an outbound SA
+ * @packets: Packets processed by the SA
+ * @bytes: Bytes processed by the SA
+ * @age_ms: Milliseconds since the hardware last reported a change in @packets
+ *
+ * The ipsec_sa_stats sysfs file of the PCI device reads as a packed array
+ * of these, one per offloaded SA.
+ */
+struct efx_ipsec_sa_stats {
+	__u32 spi;
+	__u32 flags;
+	__u64 packets;
+	__u64 bytes;
+	__u64 age_ms;
+};
+
+/**
+ * struct efx_tc_counter_stats - one offloaded TC counter
+ * @cookie: Cookie of the TC action (or rule) the counter belongs to
+ * @fw_id: Firmware counter ID
+ * @reserved: Always zero
+ * @packets: Packets counted since the counter was allocated
+ * @bytes: Bytes counted since the counter was allocated
+ * @age_ms: Milliseconds since @packets last increased
+ *
+ * The mae_counters_bin debugfs file of a port reads as a packed array of
+ * these, one per counter cookie, all taken from a single snapshot.
+ */
+struct efx_tc_counter_stats {
+	__u64 cookie;
+	__u32 fw_id;
+	__u32 reserved;
+	__u64 packets;
+	__u64 bytes;
+	__u64 age_ms;
+};
 
 /*
  * Efx private ioctls
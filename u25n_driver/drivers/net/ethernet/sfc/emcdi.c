@@ -23,6 +23,12 @@
 #include "rx_common.h"
 #include "logger.h"
 
+static unsigned int emcdi_window = EMCDI_DEFAULT_WINDOW;
+module_param(emcdi_window, uint, 0444);
+MODULE_PARM_DESC(emcdi_window,
+		 "Maximum number of eMCDI commands of each type in flight to "
+		 "the PS at once; 1=>stop-and-wait; default=8");
+
 struct efx_emcdi_blocking_data {
 	struct kref ref;
 	bool done;
@@ -171,7 +177,20 @@ static void efx_emcdi_process_cleanup_list(struct efx_emcdi_iface *emcdi,
 	}
 }
 
-/* try to advance to commands */
+/* Arm @cmd's timeout.  The pending work item holds a reference to @cmd. */
+static void efx_emcdi_arm_timer(struct efx_emcdi_iface *emcdi,
+		struct efx_emcdi_cmd *cmd)
+{
+	kref_get(&cmd->ref);
+	if (!queue_delayed_work(emcdi->work_queue, &cmd->work,
+				EMCDI_RPC_TIMEOUT))
+		kref_put(&cmd->ref, efx_emcdi_cmd_release);
+}
+
+/* try to advance to commands.  Commands in RETRY here were refused by the
+ * PS (queue full) or could not be sent, so resending them duplicates
+ * nothing; a command that timed out is resent by its own timer only.
+ */
 static void efx_emcdi_start_or_queue(struct efx_emcdi_iface *emcdi,
 		bool allow_retry,
 		struct efx_emcdi_copy_buffer *copybuf)
@@ -276,22 +295,22 @@ static bool efx_emcdi_complete_cmd(struct efx_emcdi_iface *emcdi,
 					cmd->inlen, rc, err_arg,
 					efx_mcdi_errno(emcdi->efx, rc));
 			rc = efx_mcdi_errno(emcdi->efx, rc);
-			rc = -EIO;
 		} else {
 			rc = 0;
 		}
 	}
 
 out:
-	emcdi->pending = NULL;
-
 	if (efx_emcdi_cmd_cancelled(cmd)) {
 		list_del(&cmd->list);
+		emcdi->n_running--;
 		kref_put(&cmd->ref, efx_emcdi_cmd_release);
 		completed = true;
-	} else if (rc == MC_CMD_ERR_QUEUE_FULL) {
+	} else if (rc == MC_CMD_ERR_QUEUE_FULL && !cmd->no_retry) {
 		cmd->state = EMCDI_STATE_RETRY;
 	} else {
+		if (rc == MC_CMD_ERR_QUEUE_FULL)
+			rc = -EAGAIN;
 		cmd->rc = rc;
 		cmd->outbuf = outbuf;
 		cmd->outlen = outbuf ? resp_data_len : 0;
@@ -312,6 +331,23 @@ out:
 	return completed;
 }
 
+/* Find the command a response belongs to.  Only commands that have been
+ * sent to the PS can match; queued ones have not been given a sequence
+ * number yet.
+ */
+static struct efx_emcdi_cmd *efx_emcdi_find_cmd(struct efx_emcdi_iface *emcdi,
+		u16 seq_num)
+{
+	struct efx_emcdi_cmd *cmd;
+
+	list_for_each_entry(cmd, &emcdi->cmd_list, list)
+		if (cmd->state != EMCDI_STATE_QUEUED &&
+				cmd->state != EMCDI_STATE_FINISHED &&
+				cmd->seq == seq_num)
+			return cmd;
+	return NULL;
+}
+
 static void efx_emcdi_process_message(struct efx_nic *efx, uint8_t *data,
 		uint8_t type, uint16_t seq_num)
 {
@@ -325,22 +361,12 @@ static void efx_emcdi_process_message(struct efx_nic *efx, uint8_t *data,
 		netif_err(efx, hw, efx->net_dev,
 				"eMCDI response unexpected tx type 0x%x or type not enabled\n",
 				type);
-		return;
-	}
-
-	if (seq_num != emcdi->prev_seq) {
-		netif_err(efx, hw, efx->net_dev,
-				"eMCDI response unexpected tx seq 0x%x\n",
-				seq_num);
-		/* this could theoretically just be a race between command
-		 * time out and processing the completion event,  so while not
-		 * a good sign, it'd be premature to attempt any recovery.
-		 */
+		kfree(copybuf);
 		return;
 	}
 
 	spin_lock(&emcdi->iface_lock);
-	cmd = emcdi->pending;
+	cmd = efx_emcdi_find_cmd(emcdi, seq_num);
 	if (cmd) {
 		kref_get(&cmd->ref);
 		if (efx_emcdi_complete_cmd(emcdi, cmd, data, copybuf, &cleanup_list))
@@ -348,8 +374,13 @@ static void efx_emcdi_process_message(struct efx_nic *efx, uint8_t *data,
 				kref_put(&cmd->ref, efx_emcdi_cmd_release);
 		kref_put(&cmd->ref, efx_emcdi_cmd_release);
 	} else {
+		/* this could theoretically just be a race between command
+		 * time out and processing the completion event,  so while not
+		 * a good sign, it'd be premature to attempt any recovery.
+		 */
 		netif_err(efx, hw, efx->net_dev,
-				"eMCDI response unexpected, command not found\n");
+				"eMCDI response unexpected tx seq 0x%x, command not found\n",
+				seq_num);
 	}
 	spin_unlock(&emcdi->iface_lock);
 
@@ -566,6 +597,8 @@ int efx_emcdi_init(struct efx_nic *efx, uint8_t type)
 	spin_lock_init(&emcdi->iface_lock);
 	INIT_LIST_HEAD(&emcdi->cmd_list);
 	init_waitqueue_head(&emcdi->cmd_complete_wq);
+	emcdi->window = clamp_t(unsigned int, emcdi_window, 1, EMCDI_MAX_WINDOW);
+	emcdi->n_running = 0;
 
 	snprintf(name, 32, "emcdi_queue_%d", type);
 	emcdi->work_queue = create_workqueue(name);
@@ -581,11 +614,6 @@ int efx_emcdi_init(struct efx_nic *efx, uint8_t type)
 			netif_warn(efx, drv, efx->net_dev,
                            "Failed to start MAE counters streaming, rc=%d.\n",
                            rc1);
-		snprintf(name, 32, "counter_queue_%d", type);
-		efx->cnt_queue = create_workqueue(name);
-		if (!efx->cnt_queue) {
-			goto fail;
-		}
 	}
 #endif
 
@@ -607,7 +635,6 @@ void efx_emcdi_fini(struct efx_nic *efx, uint8_t type)
 		return;
 #if 1
 	if (type == EMCDI_TYPE_MAE) {
-		destroy_workqueue(efx->cnt_queue);
 		rc = efx_mae_stop_counters(efx, efx->emcdi->channel);
 		if (rc)
 			netif_warn(efx, drv, efx->net_dev,
@@ -644,6 +671,8 @@ static void efx_emcdi_remove_cmd(struct efx_emcdi_iface *emcdi,
 		struct list_head *cleanup_list)
 {
 	list_del(&cmd->list);
+	if (cmd->state != EMCDI_STATE_QUEUED)
+		emcdi->n_running--;
 	_efx_emcdi_remove_cmd(emcdi, cmd, cleanup_list);
 	cmd->state = EMCDI_STATE_FINISHED;
 	kref_put(&cmd->ref, efx_emcdi_cmd_release);
@@ -662,13 +691,21 @@ static void efx_emcdi_timeout_cmd(struct efx_emcdi_iface *emcdi,
 			cmd->cmd, cmd->inlen, cmd->state,
 			jiffies_to_msecs(jiffies - cmd->started));
 
-	cmd->state = EMCDI_STATE_RETRY;
-	if (++cmd->retry < EMCDI_MAX_RETRY) {
-		efx_emcdi_start_or_queue(emcdi, true, NULL);
+	if (!efx_emcdi_cmd_cancelled(cmd) && !cmd->no_retry &&
+			++cmd->retry < EMCDI_MAX_RETRY) {
+		/* Resend this command alone; the caller re-arms its timer */
+		cmd->state = EMCDI_STATE_RETRY;
+		efx_emcdi_cmd_start_or_queue_ext(emcdi, cmd, NULL);
 	} else {
+		/* Complete it, so async callers see every command finish.
+		 * A cancelled command's caller has stopped waiting.
+		 */
 		cmd->rc = -ETIMEDOUT;
-		emcdi->pending = NULL;
+		if (cmd->completer && !efx_emcdi_cmd_cancelled(cmd))
+			cmd->completer(efx, cmd->cookie, cmd->rc, NULL, 0);
 		efx_emcdi_remove_cmd(emcdi, cmd, cleanup_list);
+		/* Its window slot is free; queued commands have no timer */
+		efx_emcdi_start_or_queue(emcdi, true, NULL);
 	}
 }
 
@@ -712,8 +749,6 @@ static int efx_emcdi_send_request(struct efx_emcdi_iface *emcdi,
 		return -ENOMEM;
 	}
 
-	emcdi->prev_seq = cmd->seq;
-	emcdi->pending = cmd;
 	cmd->started = jiffies;
 
 	/* Allocate an SKB to store the headers */
@@ -820,7 +855,7 @@ static int efx_emcdi_send_request(struct efx_emcdi_iface *emcdi,
 
 static u16 efx_emcdi_get_seq(struct efx_emcdi_iface *emcdi)
 {
-	return emcdi->prev_seq + 1;
+	return ++emcdi->prev_seq;
 }
 
 static int efx_emcdi_cmd_start_or_queue_ext(struct efx_emcdi_iface *emcdi,
@@ -829,25 +864,25 @@ static int efx_emcdi_cmd_start_or_queue_ext(struct efx_emcdi_iface *emcdi,
 {
 	int rc;
 
-	if (!emcdi->pending) {
+	if (cmd->state == EMCDI_STATE_QUEUED &&
+			emcdi->n_running < emcdi->window) {
 		cmd->seq = efx_emcdi_get_seq(emcdi);
 		rc = efx_emcdi_send_request(emcdi, cmd);
 		if (rc)
 			return rc;
 
 		cmd->state = EMCDI_STATE_RUNNING;
-		kref_get(&cmd->ref);
-		queue_delayed_work(emcdi->work_queue, &cmd->work,
-				EMCDI_RPC_TIMEOUT);
-	} else if(cmd->state == EMCDI_STATE_RETRY) {
+		emcdi->n_running++;
+		efx_emcdi_arm_timer(emcdi, cmd);
+	} else if (cmd->state == EMCDI_STATE_RETRY) {
+		/* Still counted in n_running, and its timer is still armed
+		 * (or is running and re-arms itself).
+		 */
 		rc = efx_emcdi_send_request(emcdi, cmd);
 		if (rc)
 			return rc;
 
-		kref_get(&cmd->ref);
-		queue_delayed_work(emcdi->work_queue, &cmd->work,
-				EMCDI_RPC_TIMEOUT);
-
+		cmd->state = EMCDI_STATE_RUNNING;
 	} else {
 		cmd->state = EMCDI_STATE_QUEUED;
 	}
@@ -881,13 +916,10 @@ static void efx_emcdi_cmd_work(struct work_struct *context)
 		return;
 	}
 
-	if (efx_emcdi_check_timeout(cmd)) {
+	if (efx_emcdi_check_timeout(cmd))
 		efx_emcdi_timeout_cmd(emcdi, cmd, &cleanup_list);
-	} else {
-		kref_get(&cmd->ref);
-		queue_delayed_work(emcdi->work_queue, &cmd->work,
-				EMCDI_RPC_TIMEOUT);
-	}
+	if (cmd->state != EMCDI_STATE_FINISHED)
+		efx_emcdi_arm_timer(emcdi, cmd);
 
 	spin_unlock_bh(&emcdi->iface_lock);
 
@@ -929,6 +961,8 @@ static int efx_emcdi_rpc_sync_internal(struct efx_nic *efx,
 	INIT_LIST_HEAD(&cmd->list);
 	INIT_LIST_HEAD(&cmd->cleanup_list);
 	cmd->rc = 0;
+	cmd->retry = 0;
+	cmd->state = EMCDI_STATE_QUEUED;
 	cmd->outbuf = NULL;
 	cmd->outlen = 0;
 
@@ -998,7 +1032,6 @@ static void efx_emcdi_cancel_cmd(struct efx_emcdi_iface *emcdi, unsigned int han
 	LIST_HEAD(cleanup_list);
 
 	spin_lock_bh(&emcdi->iface_lock);
-	emcdi->pending = NULL;
 	_efx_emcdi_cancel_cmd(emcdi, handle, &cleanup_list);
 	spin_unlock_bh(&emcdi->iface_lock);
 	efx_emcdi_process_cleanup_list(emcdi, &cleanup_list);
@@ -1012,8 +1045,9 @@ static void efx_emcdi_rpc_completer(struct efx_nic *efx, unsigned long cookie,
 		(struct efx_emcdi_blocking_data *)cookie;
 
 	wait_data->rc = rc;
-	memcpy(wait_data->outbuf, outbuf,
-			min(outlen_actual, wait_data->outlen));
+	if (outbuf)
+		memcpy(wait_data->outbuf, outbuf,
+				min(outlen_actual, wait_data->outlen));
 	wait_data->outlen_actual = outlen_actual;
 	smp_wmb();
 	wait_data->done = true;
@@ -1064,6 +1098,7 @@ static int efx_emcdi_rpc_sync(struct efx_nic *efx, unsigned int cmd,
 	cmd_item->cmd = cmd;
 	cmd_item->inlen = inlen;
 	cmd_item->inbuf = inbuf;
+	cmd_item->no_retry = false;
 
 	/* Claim an extra reference for the completer to put. */
 	kref_get(&wait_data->ref);
@@ -1097,15 +1132,21 @@ out:
 	kref_put(&wait_data->ref, efx_emcdi_blocking_data_release);
 	return rc;
 }
-#if 0
+
+/* Acknowledge counter packets up to @seq_no.  This is a fire-and-forget
+ * message to the PS with no response, so it bypasses the command queue and
+ * may be called from NAPI context.
+ */
 int efx_emcdi_rpc_send_counter_ack(struct efx_nic *efx, const efx_dword_t *inbuf,
-		size_t inlen, uint16_t seq_no)
+		size_t inlen, uint8_t type, uint16_t seq_no)
 {
 	u8 emcdi_src_mac_addr[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
 	struct efx_ef10_nic_data *nic_data = efx->nic_data;
 	struct emcdi_hdr *emcdi_hdr;
 	struct sk_buff *skb;
 
+	if (!efx->emcdi || !nic_data->have_pf_mport)
+		return -ENODEV;
 	if (!netif_running(efx->net_dev))
 		return -ENETDOWN;
 
@@ -1128,14 +1169,76 @@ int efx_emcdi_rpc_send_counter_ack(struct efx_nic *efx, const efx_dword_t *inbuf
 	emcdi_hdr->h_inner_vlan_proto = htons(ETH_P_8021Q);
 	emcdi_hdr->h_inner_vlan_TCI = htons(U25_MPORT_TO_VLAN(U25_MPORT_ID_COUNTER));
 	emcdi_hdr->h_vlan_encapsulated_proto = htons(ETH_P_802_EX1);
-	emcdi_hdr->type = EMCDI_HEADER_TYPE_COUNTER_ACK;
+	emcdi_hdr->type = type;
 	emcdi_hdr->reserved = 0;
 	emcdi_hdr->seq_num = htons(seq_no);
 
+	spin_lock_bh(&efx->emcdi->emcdi_tx_lock);
 	efx_emcdi_send_func(efx, skb);
+	spin_unlock_bh(&efx->emcdi->emcdi_tx_lock);
 	return 0;
 }
-#endif
+
+static int _efx_emcdi_rpc_async(struct efx_nic *efx, unsigned int cmd,
+		const efx_dword_t *inbuf, size_t inlen,
+		efx_emcdi_sync_completer *complete, unsigned long cookie,
+		uint8_t type, bool no_retry)
+{
+	struct efx_emcdi_iface *emcdi = efx_emcdi(efx, type);
+	struct efx_emcdi_cmd *cmd_item;
+
+	if (!efx->emcdi->channel)
+		return -ENETDOWN;
+	if (!netif_running(efx->net_dev) || !emcdi->enabled)
+		return -ENETDOWN;
+	if (!efx->link_state.up)
+		return -ENETDOWN;
+
+	cmd_item = kmalloc(sizeof(*cmd_item) + inlen, GFP_KERNEL);
+	if (!cmd_item)
+		return -ENOMEM;
+
+	kref_init(&cmd_item->ref);
+	memcpy(cmd_item + 1, inbuf, inlen);
+	cmd_item->inbuf = (const efx_dword_t *)(cmd_item + 1);
+	cmd_item->inlen = inlen;
+	cmd_item->cmd = cmd;
+	cmd_item->cookie = cookie;
+	cmd_item->completer = complete;
+	cmd_item->no_retry = no_retry;
+
+	return efx_emcdi_rpc_sync_internal(efx, cmd_item, NULL, type);
+}
+
+/* Start @cmd without waiting for it.  @inbuf is copied, so the caller may
+ * reuse it at once.  @complete is called exactly once, with the interface
+ * lock held: from the eMCDI channel's NAPI context when the response
+ * arrives, or from the timeout work with -ETIMEDOUT and no outbuf once the
+ * command has exhausted its retries.  @cookie must stay valid until then.
+ */
+int efx_emcdi_rpc_async(struct efx_nic *efx, unsigned int cmd,
+		const efx_dword_t *inbuf, size_t inlen,
+		efx_emcdi_sync_completer *complete, unsigned long cookie,
+		uint8_t type)
+{
+	return _efx_emcdi_rpc_async(efx, cmd, inbuf, inlen, complete, cookie,
+			type, false);
+}
+
+/* As efx_emcdi_rpc_async(), but @complete is called with -ETIMEDOUT on the
+ * first timeout and -EAGAIN if the PS's queue is full, rather than @cmd
+ * being resent.  For streams of commands whose effect depends on the order
+ * they arrive in, where a resend could land out of order or twice.
+ */
+int efx_emcdi_rpc_async_noretry(struct efx_nic *efx, unsigned int cmd,
+		const efx_dword_t *inbuf, size_t inlen,
+		efx_emcdi_sync_completer *complete, unsigned long cookie,
+		uint8_t type)
+{
+	return _efx_emcdi_rpc_async(efx, cmd, inbuf, inlen, complete, cookie,
+			type, true);
+}
+
 int efx_emcdi_rpc(struct efx_nic *efx, unsigned int cmd,
 		const efx_dword_t *inbuf, size_t inlen,
 		efx_dword_t *outbuf, size_t outlen,
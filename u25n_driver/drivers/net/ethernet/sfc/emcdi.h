@@ -19,6 +19,8 @@
 #define EMCDI_MAX_RETRY                         3
 #define MAX_EMCDI_SEQUENCE_NUMBER               0xffff /*as it is a running counter it will rotate*/
 #define MAX_EMCDI_PACKET_LEN                    0x44c /*Assuming MCDI v2 maximum length is 0x400*/
+#define EMCDI_DEFAULT_WINDOW                    8 /*commands in flight per eMCDI type*/
+#define EMCDI_MAX_WINDOW                        64
 
 #define EMCDI_HEADER_TYPE_CONTROL	        0
 #define EMCDI_HEADER_TYPE_COUNTER               1
@@ -66,11 +68,19 @@ int efx_emcdi_rpc(struct efx_nic *efx, unsigned int cmd,
 		efx_dword_t *outbuf, size_t outlen,
 		size_t *outlen_actual, uint8_t type);
 int efx_emcdi_rpc_send_counter_ack(struct efx_nic *efx, const efx_dword_t *inbuf,
-		size_t inlen, uint16_t seq_no);
+		size_t inlen, uint8_t type, uint16_t seq_no);
 typedef void efx_emcdi_sync_completer(struct efx_nic *efx,
 		unsigned long cookie, int rc,
 		efx_dword_t *outbuf,
 		size_t outlen_actual);
+int efx_emcdi_rpc_async(struct efx_nic *efx, unsigned int cmd,
+		const efx_dword_t *inbuf, size_t inlen,
+		efx_emcdi_sync_completer *complete, unsigned long cookie,
+		uint8_t type);
+int efx_emcdi_rpc_async_noretry(struct efx_nic *efx, unsigned int cmd,
+		const efx_dword_t *inbuf, size_t inlen,
+		efx_emcdi_sync_completer *complete, unsigned long cookie,
+		uint8_t type);
 
 /*structure definitions*/
 /**
@@ -91,6 +101,8 @@ typedef void efx_emcdi_sync_completer(struct efx_nic *efx,
  * @cmd: Command number
  * @rc: return value
  * @retry: retry count
+ * @no_retry: Complete with an error on the first timeout or %QUEUE_FULL
+ *	instead of resending
  * @outlen: outbuf length
  * @outbuf: output buffer
  */
@@ -111,6 +123,7 @@ struct efx_emcdi_cmd {
 	unsigned int cmd;
 	int rc;
 	u8  retry;
+	bool no_retry;
 	size_t outlen;
 	efx_dword_t *outbuf;
 };
@@ -138,7 +151,8 @@ enum efx_emcdi_types {
  * @cmd_complete_wq: Waitqueue for command completion
  * @prev_seq: The last used sequence number
  * @prev_handle: last used command handle
- * @pending: The running command
+ * @window: Maximum number of commands sent to the PS and not yet completed
+ * @n_running: Number of commands currently sent and awaiting a response
  * @logging_enabled: Whether to trace eMCDI
  * @logging_buffer: Buffer that may be used to build eMCDI tracing messages
  */
@@ -154,7 +168,8 @@ struct efx_emcdi_iface {
 	wait_queue_head_t cmd_complete_wq;
 	u16 prev_seq;
 	unsigned int prev_handle;
-	struct efx_emcdi_cmd *pending;
+	unsigned int window;
+	unsigned int n_running;
 #ifdef CONFIG_SFC_MCDI_LOGGING
 	bool logging_enabled;
 	char *logging_buffer;
@@ -170,7 +185,6 @@ struct efx_emcdi_data {
 	struct efx_emcdi_iface iface[MAX_EMCDI_TYPES];
 	struct efx_channel *channel;
 	spinlock_t emcdi_tx_lock;
-	struct workqueue_struct *logger_wq;
 	struct logger_info *logger;
 };
 
@@ -88,6 +88,7 @@ static const struct efx_sw_stat_desc efx_sw_stat_desc[] = {
 	EFX_ETHTOOL_UINT_CHANNEL_STAT(rx_frm_trunc),
 	EFX_ETHTOOL_UINT_CHANNEL_STAT(rx_merge_events),
 	EFX_ETHTOOL_UINT_CHANNEL_STAT(rx_merge_packets),
+	EFX_ETHTOOL_UINT_CHANNEL_STAT(rx_mport_bad),
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP)
 	EFX_ETHTOOL_UINT_CHANNEL_STAT(rx_xdp_drops),
 	EFX_ETHTOOL_UINT_CHANNEL_STAT(rx_xdp_bad_drops),
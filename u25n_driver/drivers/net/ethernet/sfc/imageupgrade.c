@@ -35,6 +35,11 @@
 #define CONST			(10 * HZ)
 #define TIMEOUT			(TIMEOUT_VAR * CONST)
 
+/* Longest wait for a streamed chunk to complete: it may be queued behind
+ * another for up to one timeout, and is never retried.
+ */
+#define IMGUP_STREAM_TIMEOUT	(2 * EMCDI_RPC_TIMEOUT + HZ)
+
 //TODO: Merging the mcdi_pcol.h and mc_driver_pcol.h
 
 struct file_details detail;
@@ -315,6 +320,161 @@ fail:
 	return rc;
 }
 
+/* Shared by upgrade_image_stream() and its chunks' completions; each
+ * chunk in flight holds a reference, so a chunk completing after the
+ * caller has given up on it never touches freed memory.
+ */
+struct imgup_stream {
+	struct kref ref;
+	wait_queue_head_t wq;
+	atomic_t in_flight;
+	int rc;
+	unsigned int status;
+};
+
+static void imgup_stream_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct imgup_stream, ref));
+}
+
+/* Called from the eMCDI channel, serialised by the interface lock */
+static void imgup_stream_complete(struct efx_nic *efx, unsigned long cookie,
+				  int rc, efx_dword_t *outbuf, size_t outlen)
+{
+	struct imgup_stream *stream = (struct imgup_stream *)cookie;
+	unsigned int status;
+
+	if (!rc && outlen != MC_CMD_IMAGE_UPGRADE_DATA_OUT_LEN)
+		rc = -EIO;
+	if (rc) {
+		if (!stream->rc)
+			WRITE_ONCE(stream->rc, rc);
+	} else {
+		status = MCDI_DWORD(outbuf, IMAGE_UPGRADE_DATA_STATUS_OUT);
+		if (status && !stream->status)
+			WRITE_ONCE(stream->status, status);
+	}
+	atomic_dec(&stream->in_flight);
+	wake_up(&stream->wq);
+	kref_put(&stream->ref, imgup_stream_release);
+}
+
+static bool imgup_stream_ready(struct imgup_stream *stream, unsigned int depth)
+{
+	return atomic_read(&stream->in_flight) < depth ||
+	       READ_ONCE(stream->rc) || READ_ONCE(stream->status);
+}
+
+/* Send a whole image as IMAGE_UPGRADE_DATA chunks, keeping up to twice the
+ * eMCDI window in flight instead of waiting for each chunk in turn.  The
+ * PS appends chunks in arrival order and they carry no offset, so chunks
+ * are never resent: the first one to time out or be refused fails the
+ * upgrade.  @image->crc is the CRC-32 the image must have; the upload
+ * fails if the bytes sent do not match it.
+ */
+static int upgrade_image_stream(struct efx_nic *efx, struct imgstream *image,
+				uint8_t type)
+{
+	MCDI_DECLARE_BUF(inbuf, MC_CMD_IMAGE_UPGRADE_DATA_IN_LEN);
+	struct efx_emcdi_iface *emcdi = efx_emcdi(efx, type);
+	const char __user *ubuf = u64_to_user_ptr(image->buffer);
+	unsigned int depth, chunk, sent = 0, next_report = 0;
+	struct imgup_stream *stream;
+	u32 crc = ~0;
+	ktime_t start;
+	int rc = 0;
+
+	if (!emcdi || !emcdi->enabled) {
+		netif_err(efx, drv, efx->net_dev, "Image upgrade not initialised\n");
+		return -ENETDOWN;
+	}
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (!stream)
+		return -ENOMEM;
+	kref_init(&stream->ref);
+	init_waitqueue_head(&stream->wq);
+	atomic_set(&stream->in_flight, 0);
+	depth = 2 * emcdi->window;
+	start = ktime_get();
+
+	while (sent < image->size) {
+		if (!wait_event_timeout(stream->wq,
+					imgup_stream_ready(stream, depth),
+					IMGUP_STREAM_TIMEOUT)) {
+			rc = -ETIMEDOUT;
+			break;
+		}
+		if (READ_ONCE(stream->rc) || READ_ONCE(stream->status))
+			break;
+
+		chunk = min_t(unsigned int, image->size - sent,
+			      MC_CMD_IMAGE_UPGRADE_DATA_BIN_IN_LEN);
+		if (copy_from_user(MCDI_PTR(inbuf, IMAGE_UPGRADE_DATA_BIN_IN),
+				   ubuf + sent, chunk)) {
+			rc = -EFAULT;
+			break;
+		}
+		MCDI_SET_DWORD(inbuf, IMAGE_UPGRADE_DATA_SIZ_IN, chunk);
+		crc = crc32(crc, MCDI_PTR(inbuf, IMAGE_UPGRADE_DATA_BIN_IN), chunk);
+
+		kref_get(&stream->ref);
+		atomic_inc(&stream->in_flight);
+		rc = efx_emcdi_rpc_async_noretry(efx, MC_CMD_IMAGE_UPGRADE_DATA,
+						 inbuf, sizeof(inbuf),
+						 imgup_stream_complete,
+						 (unsigned long)stream, type);
+		if (rc) {
+			atomic_dec(&stream->in_flight);
+			kref_put(&stream->ref, imgup_stream_release);
+			break;
+		}
+		sent += chunk;
+
+		if (sent >= next_report) {
+			netif_dbg(efx, drv, efx->net_dev,
+				  "Image upload %u/%u bytes\n", sent, image->size);
+			next_report += image->size / 10;
+		}
+	}
+
+	/* Let every chunk sent finish even after an error, so that none is
+	 * still pending when FINI or a fresh upload follows
+	 */
+	if (!wait_event_timeout(stream->wq, !atomic_read(&stream->in_flight),
+				IMGUP_STREAM_TIMEOUT) && !rc)
+		rc = -ETIMEDOUT;
+
+	if (!rc)
+		rc = READ_ONCE(stream->rc);
+	image->status = READ_ONCE(stream->status);
+	if (!rc && image->status)
+		rc = -EIO;
+	crc ^= ~0;
+	if (!rc && crc != image->crc) {
+		netif_err(efx, drv, efx->net_dev,
+			  "Image upload crc32 %08x, expected %08x\n",
+			  crc, image->crc);
+		rc = -EIO;
+	}
+	image->crc = crc;
+	image->usecs = ktime_us_delta(ktime_get(), start);
+	kref_put(&stream->ref, imgup_stream_release);
+
+	if (rc)
+		netif_err(efx, drv, efx->net_dev,
+			  "Image upload failed after %u bytes, rc %d status %u\n",
+			  sent, rc, image->status);
+	else
+		netif_info(efx, drv, efx->net_dev,
+			   "Image upload of %u bytes took %u ms (%llu KiB/s), crc32 %08x\n",
+			   sent, image->usecs / 1000,
+			   div_u64((u64)sent * USEC_PER_SEC,
+				   max(image->usecs, 1u) * 1024ULL),
+			   image->crc);
+	return rc;
+}
+
 static int fini_img_upgrade(struct efx_nic *efx, struct fini_details *fini_details, uint8_t type)
 {
 	int rc = 1;
@@ -630,6 +790,17 @@ static int perform_fpga_operation(struct efx_nic *efx, struct ifreq *ifr)
 			if (rc1)
 				netif_err(efx, drv, efx->net_dev, "Copy to user failed.\n");
                         break;
+                case UPGRADE_STREAM:
+			rc = upgrade_image_stream(efx, &(command->cmd_info.stream), EMCDI_TYPE_IMG);
+			if (rc != 0) {
+				set_legacy_mode(efx);
+				efx_mac_loopback(efx, false);
+			}
+
+			rc1 = copy_to_user((struct command_format *)(ifr->ifr_data), command, sizeof(struct command_format));
+			if (rc1)
+				netif_err(efx, drv, efx->net_dev, "Copy to user failed.\n");
+			break;
 		case CHECK_LINK:
 			rc = check_link(efx);
 			if (rc != 0) {
@@ -725,6 +896,17 @@ static int perform_flash_operation(struct efx_nic *efx, struct ifreq *ifr)
 				efx_mac_loopback(efx, false);
 			} 
 
+			rc1 = copy_to_user((struct command_format *)(ifr->ifr_data), command, sizeof(struct command_format));
+			if (rc1)
+				netif_err(efx, drv, efx->net_dev, "Copy to user failed.\n");
+			break;
+		case UPGRADE_STREAM:
+			rc = upgrade_image_stream(efx, &(command->cmd_info.stream), EMCDI_TYPE_FLASH_UPGRADE);
+			if (rc != 0) {
+				set_legacy_mode(efx);
+				efx_mac_loopback(efx, false);
+			}
+
 			rc1 = copy_to_user((struct command_format *)(ifr->ifr_data), command, sizeof(struct command_format));
 			if (rc1)
 				netif_err(efx, drv, efx->net_dev, "Copy to user failed.\n");
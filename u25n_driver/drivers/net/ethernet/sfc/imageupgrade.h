@@ -29,6 +29,20 @@ struct imgdata {
 	char buffer[];
 }__attribute__((packed));
 
+/* UPGRADE_STREAM: the whole image is passed by address and the driver keeps
+ * several data chunks in flight to the PS.  @crc is the CRC-32 (as zlib
+ * crc32()) of the image, as later given to FINI; the upload fails with
+ * -EIO if the bytes sent do not match it.  On return it holds the CRC-32
+ * of the bytes sent.
+ */
+struct imgstream {
+	unsigned int status;	/* first non-zero PS status, or 0 */
+	unsigned int crc;	/* in: expected; out: actual */
+	uint64_t buffer;	/* user address of the image */
+	unsigned int size;
+	unsigned int usecs;	/* out: time taken */
+};
+
 struct fini_details {
 	unsigned int status;
 	unsigned long crc;
@@ -45,6 +59,7 @@ union info
 {
         struct file_details init_details;
         struct imgdata image;
+        struct imgstream stream;
         struct fini_details fini_details;
         unsigned int flash_index;
 	struct flash_upgrade_status flash_status;
@@ -7,6 +7,8 @@
  * by the Free Software Foundation, incorporated herein by reference.
  */
 
+#include <linux/rhashtable.h>
+#include <linux/vmalloc.h>
 #include "nic.h"
 #include "efx_ioctl.h"
 #include "emcdi.h"
@@ -53,22 +55,220 @@ struct ipsec_query_sa {
 	uint64_t ipsec_offload_bytes;
 };
 
-static int efx_ipsec_del_sa_enc(struct efx_nic *efx, struct ipsec_del_sa_enc *sa)
+/**
+ * struct efx_ipsec_sa - hardware statistics of one offloaded SA
+ * @spi: SPI as given to the ADD_SA ioctl; the hashtable key
+ * @linkage: Entry in &efx_ipsec_state.sa_ht
+ * @sc: Source context the SA was installed with
+ * @dc: Destination context the SA was installed with
+ * @encrypt: Outbound SA, i.e. added with %IPSEC_OFFLOAD_ADD_SA_ENC
+ * @packets: Latest cumulative packet count reported by the hardware
+ * @bytes: Latest cumulative byte count reported by the hardware
+ * @touched: jiffies when @packets last changed
+ * @rcu: For deferred freeing
+ */
+struct efx_ipsec_sa {
+	u32 spi;
+	struct rhash_head linkage;
+	u32 sc;
+	u32 dc;
+	bool encrypt;
+	u64 packets;
+	u64 bytes;
+	unsigned long touched;
+	struct rcu_head rcu;
+};
+
+/**
+ * struct efx_ipsec_state - per-function IPsec offload state
+ * @sa_ht: Offloaded SAs, by SPI
+ * @lock: Serialises changes to @sa_ht and to SA counters.  Taken from the
+ *	TC channel's NAPI context, so process context must use spin_lock_bh()
+ * @n_unknown: Counter updates received for SPIs not in @sa_ht
+ * @snap_lock: Protects @snap and @snap_len
+ * @snap: Copy of every SA's statistics, taken when the ipsec_sa_stats file
+ *	is read from offset 0 and served to the reads that follow
+ * @snap_len: Size of @snap in bytes
+ */
+struct efx_ipsec_state {
+	struct rhashtable sa_ht;
+	spinlock_t lock;
+	unsigned long n_unknown;
+	struct mutex snap_lock;
+	struct efx_ipsec_sa_stats *snap;
+	size_t snap_len;
+};
+
+static const struct rhashtable_params efx_ipsec_sa_ht_params = {
+	.key_len	= sizeof(u32),
+	.key_offset	= offsetof(struct efx_ipsec_sa, spi),
+	.head_offset	= offsetof(struct efx_ipsec_sa, linkage),
+};
+
+/* Start tracking statistics for an SA the PS has just accepted.  A stale
+ * entry for the same SPI (e.g. its delete failed) is replaced.
+ */
+static void efx_ipsec_sa_track(struct efx_nic *efx, u32 spi, u32 sc, u32 dc,
+			       bool encrypt)
+{
+	struct efx_ipsec_state *ipsec = rtnl_dereference(efx->ipsec);
+	struct efx_ipsec_sa *sa, *old;
+
+	if (!ipsec)
+		return;
+	sa = kzalloc(sizeof(*sa), GFP_KERNEL);
+	if (!sa)
+		return;
+	sa->spi = spi;
+	sa->sc = sc;
+	sa->dc = dc;
+	sa->encrypt = encrypt;
+	sa->touched = jiffies;
+
+	spin_lock_bh(&ipsec->lock);
+	old = rhashtable_lookup_fast(&ipsec->sa_ht, &spi, efx_ipsec_sa_ht_params);
+	if (old) {
+		rhashtable_remove_fast(&ipsec->sa_ht, &old->linkage,
+				       efx_ipsec_sa_ht_params);
+		kfree_rcu(old, rcu);
+	}
+	if (rhashtable_insert_fast(&ipsec->sa_ht, &sa->linkage,
+				   efx_ipsec_sa_ht_params))
+		kfree(sa);
+	spin_unlock_bh(&ipsec->lock);
+}
+
+static void efx_ipsec_sa_untrack(struct efx_nic *efx, struct efx_ipsec_sa *sa)
+{
+	struct efx_ipsec_state *ipsec = rtnl_dereference(efx->ipsec);
+
+	spin_lock_bh(&ipsec->lock);
+	rhashtable_remove_fast(&ipsec->sa_ht, &sa->linkage,
+			       efx_ipsec_sa_ht_params);
+	spin_unlock_bh(&ipsec->lock);
+	kfree_rcu(sa, rcu);
+}
+
+static void efx_ipsec_sa_untrack_spi(struct efx_nic *efx, u32 spi)
+{
+	struct efx_ipsec_state *ipsec = rtnl_dereference(efx->ipsec);
+	struct efx_ipsec_sa *sa;
+
+	if (!ipsec)
+		return;
+	sa = rhashtable_lookup_fast(&ipsec->sa_ht, &spi, efx_ipsec_sa_ht_params);
+	if (sa)
+		efx_ipsec_sa_untrack(efx, sa);
+}
+
+/* IPSEC_OFFLOAD_DEL_SA_ENC identifies the SA by its contexts, not its SPI */
+static void efx_ipsec_sa_untrack_enc(struct efx_nic *efx, u32 sc, u32 dc)
+{
+	struct efx_ipsec_state *ipsec = rtnl_dereference(efx->ipsec);
+	struct efx_ipsec_sa *sa, *found = NULL;
+	struct rhashtable_iter walk;
+
+	if (!ipsec)
+		return;
+	rhashtable_walk_enter(&ipsec->sa_ht, &walk);
+	rhashtable_walk_start(&walk);
+	while ((sa = rhashtable_walk_next(&walk)) != NULL) {
+		if (IS_ERR(sa))
+			continue;
+		if (sa->encrypt && sa->sc == sc && sa->dc == dc) {
+			found = sa;
+			break;
+		}
+	}
+	rhashtable_walk_stop(&walk);
+	rhashtable_walk_exit(&walk);
+	/* Only this (rtnl-serialised) path frees entries, so found is stable */
+	if (found)
+		efx_ipsec_sa_untrack(efx, found);
+}
+
+/* Called from efx_tc_rx() for each EMCDI_HEADER_TYPE_IPSEC_COUNTER packet.
+ * The counts are cumulative since the SA was installed.
+ */
+void efx_ipsec_update_sa_stats(struct efx_nic *efx, u32 spi, u64 packets,
+			       u64 bytes)
+{
+	struct efx_ipsec_state *ipsec;
+	struct efx_ipsec_sa *sa;
+
+	rcu_read_lock();
+	ipsec = rcu_dereference(efx->ipsec);
+	if (!ipsec)
+		goto out;
+	spin_lock(&ipsec->lock);
+	sa = rhashtable_lookup_fast(&ipsec->sa_ht, &spi, efx_ipsec_sa_ht_params);
+	if (!sa) {
+		ipsec->n_unknown++;
+	} else {
+		if (packets != sa->packets)
+			sa->touched = jiffies;
+		sa->packets = packets;
+		sa->bytes = bytes;
+	}
+	spin_unlock(&ipsec->lock);
+out:
+	rcu_read_unlock();
+}
+
+static void efx_ipsec_sa_fill_stats(struct efx_ipsec_sa *sa,
+				    struct efx_ipsec_sa_stats *stats)
+{
+	stats->spi = sa->spi;
+	stats->flags = sa->encrypt ? EFX_IPSEC_SA_STATS_ENCRYPT : 0;
+	stats->packets = sa->packets;
+	stats->bytes = sa->bytes;
+	stats->age_ms = jiffies_to_msecs(jiffies - sa->touched);
+}
+
+static int efx_ipsec_query_sa(struct efx_nic *efx, struct ipsec_query_sa *query)
+{
+	struct efx_ipsec_state *ipsec = rtnl_dereference(efx->ipsec);
+	struct efx_ipsec_sa *sa;
+	int rc = -ENOENT;
+
+	/* Report zeroes for SAs we know nothing about */
+	query->ipsec_offload_packets = 0;
+	query->ipsec_offload_bytes = 0;
+	if (!ipsec)
+		return rc;
+
+	spin_lock_bh(&ipsec->lock);
+	sa = rhashtable_lookup_fast(&ipsec->sa_ht, &query->ipsec_offload_spi,
+				    efx_ipsec_sa_ht_params);
+	if (sa) {
+		query->ipsec_offload_packets = sa->packets;
+		query->ipsec_offload_bytes = sa->bytes;
+		rc = 0;
+	}
+	spin_unlock_bh(&ipsec->lock);
+	return rc;
+}
+
+static void efx_ipsec_fill_del_sa_enc(efx_dword_t *inbuf,
+				      struct ipsec_del_sa_enc *sa)
 {
-	//	struct ipsec_stat old_del_sa_enc;
-	//      int ret;
-	MCDI_DECLARE_BUF(inbuf,MC_CMD_IPSEC_OFFLOAD_DEL_SA_ENC);
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_DEL_SA_ENC_SC, sa->ipsec_offload_sc);
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_DEL_SA_ENC_DC, sa->ipsec_offload_dc);
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_DEL_SA_ENC_PROTOCOL, sa->ipsec_offload_protocol);
+}
+
+static int efx_ipsec_del_sa_enc(struct efx_nic *efx, struct ipsec_del_sa_enc *sa)
+{
+	MCDI_DECLARE_BUF(inbuf,MC_CMD_IPSEC_OFFLOAD_DEL_SA_ENC);
 
+	efx_ipsec_fill_del_sa_enc(inbuf, sa);
 	return efx_emcdi_rpc(efx, MC_CMD_IPSEC_DEL_SA_ENC, inbuf,
 			sizeof(inbuf), NULL, 0, NULL, EMCDI_TYPE_IPSEC);
 }
 
-static int efx_ipsec_add_sa_enc(struct efx_nic *efx, struct ipsec_add_sa_enc *sa)
+static void efx_ipsec_fill_add_sa_enc(efx_dword_t *inbuf,
+				      struct ipsec_add_sa_enc *sa)
 {
-	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_ADD_SA_ENC);
 	uint8_t tmp;
 	int i;
 
@@ -89,14 +289,20 @@ static int efx_ipsec_add_sa_enc(struct efx_nic *efx, struct ipsec_add_sa_enc *sa
 			sizeof(sa->ipsec_offload_eiv));
 	memcpy(MCDI_PTR(inbuf, IPSEC_OFFLOAD_ADD_SA_ENC_KEY), sa->ipsec_offload_key,
 			sizeof(sa->ipsec_offload_key));
+}
+
+static int efx_ipsec_add_sa_enc(struct efx_nic *efx, struct ipsec_add_sa_enc *sa)
+{
+	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_ADD_SA_ENC);
 
+	efx_ipsec_fill_add_sa_enc(inbuf, sa);
 	return efx_emcdi_rpc(efx, MC_CMD_IPSEC_ADD_SA_ENC, inbuf,
 			sizeof(inbuf), NULL, 0, NULL, EMCDI_TYPE_IPSEC);
 }
 
-static int efx_ipsec_add_sa_dec(struct efx_nic *efx, struct ipsec_add_sa_dec *sa)
+static void efx_ipsec_fill_add_sa_dec(efx_dword_t *inbuf,
+				      struct ipsec_add_sa_dec *sa)
 {
-	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_ADD_SA_DEC);
 	uint8_t tmp;
 	int i;
 
@@ -113,23 +319,291 @@ static int efx_ipsec_add_sa_dec(struct efx_nic *efx, struct ipsec_add_sa_dec *sa
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_ADD_SA_DEC_IIV, sa->ipsec_offload_iiv);
 	memcpy(MCDI_PTR(inbuf, IPSEC_OFFLOAD_ADD_SA_DEC_KEY), 
 			sa->ipsec_offload_key, sizeof(sa->ipsec_offload_key));
+}
 
+static int efx_ipsec_add_sa_dec(struct efx_nic *efx, struct ipsec_add_sa_dec *sa)
+{
+	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_ADD_SA_DEC);
+
+	efx_ipsec_fill_add_sa_dec(inbuf, sa);
 	return efx_emcdi_rpc(efx, MC_CMD_IPSEC_ADD_SA_DEC, inbuf,
 			sizeof(inbuf), NULL, 0, NULL, EMCDI_TYPE_IPSEC);
 }
 
-static int efx_ipsec_del_sa_dec(struct efx_nic *efx, struct ipsec_del_sa_dec *sa)
+static void efx_ipsec_fill_del_sa_dec(efx_dword_t *inbuf,
+				      struct ipsec_del_sa_dec *sa)
 {
-	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_DEL_SA_DEC);
-
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_DEL_SA_DEC_SC, sa->ipsec_offload_sc);
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_DEL_SA_DEC_DC, sa->ipsec_offload_dc);
 	MCDI_SET_DWORD(inbuf, IPSEC_OFFLOAD_DEL_SA_DEC_SPI, sa->ipsec_offload_spi);
+}
+
+static int efx_ipsec_del_sa_dec(struct efx_nic *efx, struct ipsec_del_sa_dec *sa)
+{
+	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_DEL_SA_DEC);
 
+	efx_ipsec_fill_del_sa_dec(inbuf, sa);
 	return efx_emcdi_rpc(efx, MC_CMD_IPSEC_DEL_SA_DEC, inbuf,
 			sizeof(inbuf), NULL, 0, NULL, EMCDI_TYPE_IPSEC);
 }
 
+/* Longest wait for the next command of a batch to complete */
+#define EFX_IPSEC_BATCH_TIMEOUT	((EMCDI_MAX_RETRY + 1) * EMCDI_RPC_TIMEOUT)
+
+struct efx_ipsec_batch_ctx;
+
+/* Result slot of one IPSEC_OFFLOAD_BATCH entry, the async completion cookie */
+struct efx_ipsec_batch_cmd {
+	struct efx_ipsec_batch_ctx *batch;
+	int rc;
+};
+
+/* Shared by efx_ipsec_batch_ioctl() and its commands' completions; each
+ * command in flight holds a reference, so one completing after the ioctl
+ * has given up on it never touches freed memory.
+ */
+struct efx_ipsec_batch_ctx {
+	struct kref ref;
+	wait_queue_head_t wq;
+	atomic_t in_flight;
+	struct efx_ipsec_batch_cmd cmds[];
+};
+
+static void efx_ipsec_batch_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct efx_ipsec_batch_ctx, ref));
+}
+
+/* Called from the eMCDI channel, serialised by the interface lock */
+static void efx_ipsec_batch_complete(struct efx_nic *efx, unsigned long cookie,
+				     int rc, efx_dword_t *outbuf, size_t outlen)
+{
+	struct efx_ipsec_batch_cmd *cmd = (struct efx_ipsec_batch_cmd *)cookie;
+	struct efx_ipsec_batch_ctx *batch = cmd->batch;
+
+	WRITE_ONCE(cmd->rc, rc);
+	atomic_dec(&batch->in_flight);
+	wake_up(&batch->wq);
+	kref_put(&batch->ref, efx_ipsec_batch_release);
+}
+
+/* Wait for every command of @batch sent so far.  Each wait is bounded and
+ * must see progress, so a PS that stops answering costs one timeout.
+ */
+static bool efx_ipsec_batch_drain(struct efx_ipsec_batch_ctx *batch)
+{
+	int n;
+
+	while ((n = atomic_read(&batch->in_flight)) > 0)
+		if (!wait_event_timeout(batch->wq,
+					atomic_read(&batch->in_flight) < n,
+					EFX_IPSEC_BATCH_TIMEOUT))
+			return false;
+	return true;
+}
+
+/* Every SA request starts with its source and destination contexts, which
+ * identify the SA to a delete.  Entries for the same pair must not overtake
+ * each other, or e.g. a resent DEL_SA_ENC could remove the SA that a later
+ * ADD_SA_ENC installed.
+ */
+static bool efx_ipsec_batch_dependent(const struct efx_ipsec_batch_entry *a,
+				      const struct efx_ipsec_batch_entry *b)
+{
+	const struct ipsec_del_sa_dec *sa = (const void *)a->sa;
+	const struct ipsec_del_sa_dec *sb = (const void *)b->sa;
+
+	BUILD_BUG_ON(offsetof(struct ipsec_add_sa_enc, ipsec_offload_sc) != 0 ||
+		     offsetof(struct ipsec_add_sa_enc, ipsec_offload_dc) != 4);
+	BUILD_BUG_ON(offsetof(struct ipsec_add_sa_dec, ipsec_offload_sc) != 0 ||
+		     offsetof(struct ipsec_add_sa_dec, ipsec_offload_dc) != 4);
+	BUILD_BUG_ON(offsetof(struct ipsec_del_sa_enc, ipsec_offload_sc) != 0 ||
+		     offsetof(struct ipsec_del_sa_enc, ipsec_offload_dc) != 4);
+	BUILD_BUG_ON(offsetof(struct ipsec_del_sa_dec, ipsec_offload_sc) != 0 ||
+		     offsetof(struct ipsec_del_sa_dec, ipsec_offload_dc) != 4);
+
+	return sa->ipsec_offload_sc == sb->ipsec_offload_sc &&
+	       sa->ipsec_offload_dc == sb->ipsec_offload_dc;
+}
+
+static int efx_ipsec_batch_start(struct efx_nic *efx,
+				 struct efx_ipsec_batch_entry *ent,
+				 struct efx_ipsec_batch_cmd *cmd)
+{
+	/* Large enough for any of the SA requests */
+	MCDI_DECLARE_BUF(inbuf, MC_CMD_IPSEC_OFFLOAD_ADD_SA_ENC);
+	unsigned int mc_cmd;
+	size_t inlen;
+	int rc;
+
+	switch (ent->op) {
+	case IPSEC_OFFLOAD_ADD_SA_ENC:
+		efx_ipsec_fill_add_sa_enc(inbuf, (void *)ent->sa);
+		mc_cmd = MC_CMD_IPSEC_ADD_SA_ENC;
+		inlen = MC_CMD_IPSEC_OFFLOAD_ADD_SA_ENC;
+		break;
+	case IPSEC_OFFLOAD_ADD_SA_DEC:
+		efx_ipsec_fill_add_sa_dec(inbuf, (void *)ent->sa);
+		mc_cmd = MC_CMD_IPSEC_ADD_SA_DEC;
+		inlen = MC_CMD_IPSEC_OFFLOAD_ADD_SA_DEC;
+		break;
+	case IPSEC_OFFLOAD_DEL_SA_ENC:
+		efx_ipsec_fill_del_sa_enc(inbuf, (void *)ent->sa);
+		mc_cmd = MC_CMD_IPSEC_DEL_SA_ENC;
+		inlen = MC_CMD_IPSEC_OFFLOAD_DEL_SA_ENC;
+		break;
+	case IPSEC_OFFLOAD_DEL_SA_DEC:
+		efx_ipsec_fill_del_sa_dec(inbuf, (void *)ent->sa);
+		mc_cmd = MC_CMD_IPSEC_DEL_SA_DEC;
+		inlen = MC_CMD_IPSEC_OFFLOAD_DEL_SA_DEC;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	cmd->rc = -ETIMEDOUT;
+	kref_get(&cmd->batch->ref);
+	atomic_inc(&cmd->batch->in_flight);
+	rc = efx_emcdi_rpc_async(efx, mc_cmd, inbuf, inlen,
+				 efx_ipsec_batch_complete,
+				 (unsigned long)cmd, EMCDI_TYPE_IPSEC);
+	if (rc) {
+		atomic_dec(&cmd->batch->in_flight);
+		kref_put(&cmd->batch->ref, efx_ipsec_batch_release);
+	}
+	return rc;
+}
+
+/* Update SA tracking for a batch entry, as the single ioctls do */
+static void efx_ipsec_batch_track(struct efx_nic *efx,
+				  struct efx_ipsec_batch_entry *ent)
+{
+	struct ipsec_add_sa_enc *add_enc = (void *)ent->sa;
+	struct ipsec_add_sa_dec *add_dec = (void *)ent->sa;
+	struct ipsec_del_sa_enc *del_enc = (void *)ent->sa;
+	struct ipsec_del_sa_dec *del_dec = (void *)ent->sa;
+
+	switch (ent->op) {
+	case IPSEC_OFFLOAD_ADD_SA_ENC:
+		if (!ent->rc)
+			efx_ipsec_sa_track(efx, add_enc->ipsec_offload_spi,
+					   add_enc->ipsec_offload_sc,
+					   add_enc->ipsec_offload_dc, true);
+		break;
+	case IPSEC_OFFLOAD_ADD_SA_DEC:
+		if (!ent->rc)
+			efx_ipsec_sa_track(efx, add_dec->ipsec_offload_spi,
+					   add_dec->ipsec_offload_sc,
+					   add_dec->ipsec_offload_dc, false);
+		break;
+	case IPSEC_OFFLOAD_DEL_SA_ENC:
+		efx_ipsec_sa_untrack_enc(efx, del_enc->ipsec_offload_sc,
+					 del_enc->ipsec_offload_dc);
+		break;
+	case IPSEC_OFFLOAD_DEL_SA_DEC:
+		efx_ipsec_sa_untrack_spi(efx, del_dec->ipsec_offload_spi);
+		break;
+	}
+}
+
+/* Handle an IPSEC_OFFLOAD_BATCH ioctl.  Entries are sent to the PS in order
+ * without waiting for replies, so the batch costs about one round trip per
+ * eMCDI window rather than one per SA.  Replies, and commands resent after
+ * a timeout, may arrive out of order, so an entry for the same SA contexts
+ * as one still in flight waits for everything sent before it.  The
+ * per-entry result is written back to userspace.
+ * Context: process, rtnl_lock() held.
+ */
+static int efx_ipsec_batch_ioctl(struct efx_nic *efx, struct ifreq *ifr)
+{
+	struct efx_ipsec_batch __user *ubatch = ifr->ifr_data;
+	struct efx_emcdi_iface *emcdi = efx_emcdi(efx, EMCDI_TYPE_IPSEC);
+	struct efx_ipsec_batch_ctx *ctx;
+	struct efx_ipsec_batch_entry *ents;
+	struct efx_ipsec_batch batch;
+	unsigned int i, j, fence = 0;
+	bool stalled = false;
+	int rc = 0;
+
+	BUILD_BUG_ON(sizeof(struct ipsec_add_sa_enc) > EFX_IPSEC_BATCH_SA_LEN);
+	BUILD_BUG_ON(sizeof(struct ipsec_add_sa_dec) > EFX_IPSEC_BATCH_SA_LEN);
+	BUILD_BUG_ON(sizeof(struct ipsec_del_sa_enc) > EFX_IPSEC_BATCH_SA_LEN);
+	BUILD_BUG_ON(sizeof(struct ipsec_del_sa_dec) > EFX_IPSEC_BATCH_SA_LEN);
+
+	if (!emcdi || !emcdi->enabled)
+		return -ENETDOWN;
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.count)
+		return 0;
+	if (batch.count > EFX_IPSEC_BATCH_MAX)
+		return -E2BIG;
+
+	ents = memdup_user(ubatch->entries, array_size(batch.count, sizeof(*ents)));
+	if (IS_ERR(ents))
+		return PTR_ERR(ents);
+	ctx = kzalloc(struct_size(ctx, cmds, batch.count), GFP_KERNEL);
+	if (!ctx) {
+		kfree(ents);
+		return -ENOMEM;
+	}
+	kref_init(&ctx->ref);
+	init_waitqueue_head(&ctx->wq);
+	atomic_set(&ctx->in_flight, 0);
+
+	for (i = 0; i < batch.count; i++) {
+		ctx->cmds[i].batch = ctx;
+		if (stalled) {
+			ents[i].rc = -ECANCELED;
+			continue;
+		}
+		/* Entries from @fence on may still be in flight */
+		for (j = fence; j < i; j++)
+			if (efx_ipsec_batch_dependent(&ents[j], &ents[i]))
+				break;
+		if (j < i) {
+			if (!efx_ipsec_batch_drain(ctx)) {
+				netif_err(efx, drv, efx->net_dev,
+					  "IPsec batch stalled at entry %u\n", i);
+				stalled = true;
+				ents[i].rc = -ECANCELED;
+				continue;
+			}
+			fence = i;
+			/* A copy of an entry that timed out may still be
+			 * on its way to the PS
+			 */
+			if (!ents[j].rc && ctx->cmds[j].rc == -ETIMEDOUT) {
+				ents[i].rc = -ECANCELED;
+				continue;
+			}
+		}
+		ents[i].rc = efx_ipsec_batch_start(efx, &ents[i], &ctx->cmds[i]);
+		if (ents[i].rc)
+			netif_dbg(efx, drv, efx->net_dev,
+				  "IPsec batch entry %u (op %#x) not sent, rc %d\n",
+				  i, ents[i].op, ents[i].rc);
+	}
+	/* Commands still outstanding after this keep their -ETIMEDOUT */
+	if (!stalled)
+		efx_ipsec_batch_drain(ctx);
+
+	for (i = 0; i < batch.count; i++) {
+		if (!ents[i].rc)
+			ents[i].rc = READ_ONCE(ctx->cmds[i].rc);
+		/* Cancelled entries never reached the PS */
+		if (ents[i].rc != -ECANCELED)
+			efx_ipsec_batch_track(efx, &ents[i]);
+		/* Only the results go back; the keys stay in the kernel copy */
+		if (put_user(ents[i].rc, &ubatch->entries[i].rc))
+			rc = -EFAULT;
+	}
+
+	kref_put(&ctx->ref, efx_ipsec_batch_release);
+	kfree(ents);
+	return rc;
+}
+
 int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd)
 {
 	struct ipsec_add_sa_dec *add_sa_dec;
@@ -149,6 +623,10 @@ int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd)
 			}
 
 			rc = efx_ipsec_add_sa_dec(efx, add_sa_dec);
+			if (!rc)
+				efx_ipsec_sa_track(efx, add_sa_dec->ipsec_offload_spi,
+						   add_sa_dec->ipsec_offload_sc,
+						   add_sa_dec->ipsec_offload_dc, false);
 			kfree(add_sa_dec);
 			break;
 		case IPSEC_OFFLOAD_ADD_SA_ENC :
@@ -160,6 +638,10 @@ int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd)
 			}
 
 			rc = efx_ipsec_add_sa_enc(efx, add_sa_enc);
+			if (!rc)
+				efx_ipsec_sa_track(efx, add_sa_enc->ipsec_offload_spi,
+						   add_sa_enc->ipsec_offload_sc,
+						   add_sa_enc->ipsec_offload_dc, true);
 			kfree(add_sa_enc);
 			break;
 		case IPSEC_OFFLOAD_DEL_SA_ENC :
@@ -172,6 +654,8 @@ int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd)
 			}
 
 			rc = efx_ipsec_del_sa_enc(efx,del_sa_enc);
+			efx_ipsec_sa_untrack_enc(efx, del_sa_enc->ipsec_offload_sc,
+						 del_sa_enc->ipsec_offload_dc);
 			kfree(del_sa_enc);
 			break;
 		case IPSEC_OFFLOAD_DEL_SA_DEC :
@@ -185,8 +669,11 @@ int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd)
 			}
 
 			rc = efx_ipsec_del_sa_dec(efx, del_sa_dec);
+			efx_ipsec_sa_untrack_spi(efx, del_sa_dec->ipsec_offload_spi);
 			kfree(del_sa_dec);
 			break;
+		case IPSEC_OFFLOAD_BATCH :
+			return efx_ipsec_batch_ioctl(efx, ifr);
 		case IPSEC_OFFLOAD_QUERY_SA : 
 			query_sa = kmalloc(sizeof(struct ipsec_query_sa), GFP_KERNEL);
 
@@ -196,13 +683,10 @@ int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd)
 				return -EFAULT;
 			}
 
-#if 0
-			// TODO - update statistics
-			query_sa->ipsec_offload_packets = 1234;
-			query_sa->ipsec_offload_bytes = 1111;
-#endif
-			copy_to_user((struct ipsec_query_sa * )ifr->ifr_data, query_sa, 
-					sizeof(struct ipsec_query_sa));
+			rc = efx_ipsec_query_sa(efx, query_sa);
+			if (copy_to_user((struct ipsec_query_sa * )ifr->ifr_data, query_sa,
+					sizeof(struct ipsec_query_sa)))
+				rc = -EFAULT;
 			kfree(query_sa);
 			break;
 		default:
@@ -243,12 +727,134 @@ static ssize_t ipsec_enable_store(struct device *dev,
 
 static DEVICE_ATTR_RW(ipsec_enable);
 
+/* Take a copy of every SA's statistics.  Called with ipsec->snap_lock held. */
+static int efx_ipsec_sa_snapshot(struct efx_ipsec_state *ipsec)
+{
+	struct efx_ipsec_sa_stats *snap;
+	struct rhashtable_iter walk;
+	struct efx_ipsec_sa *sa;
+	unsigned int n = 0, max;
+
+	/* Leave some room for SAs added while we walk */
+	max = atomic_read(&ipsec->sa_ht.nelems) + 16;
+	snap = vzalloc(max * sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+
+	rhashtable_walk_enter(&ipsec->sa_ht, &walk);
+	rhashtable_walk_start(&walk);
+	while (n < max && (sa = rhashtable_walk_next(&walk)) != NULL) {
+		if (IS_ERR(sa))
+			continue;
+		spin_lock_bh(&ipsec->lock);
+		efx_ipsec_sa_fill_stats(sa, &snap[n++]);
+		spin_unlock_bh(&ipsec->lock);
+	}
+	rhashtable_walk_stop(&walk);
+	rhashtable_walk_exit(&walk);
+
+	vfree(ipsec->snap);
+	ipsec->snap = snap;
+	ipsec->snap_len = n * sizeof(*snap);
+	return 0;
+}
+
+/* Bulk export of all SA counters as a packed array of
+ * struct efx_ipsec_sa_stats.  sysfs hands us at most a page at a time, so
+ * a read from offset 0 takes a snapshot of the whole table and the reads
+ * that follow are served from it.  Readers racing each other from offset
+ * 0 may see the snapshot retaken between their reads.
+ */
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_BIN_ATTRIBUTE_OP_FILE_PARAM)
+static ssize_t ipsec_sa_stats_read(struct file *filp, struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#else
+static ssize_t ipsec_sa_stats_read(struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#endif
+{
+	struct device *dev = kobj_to_dev(kobj);
+	struct efx_nic *efx = pci_get_drvdata(to_pci_dev(dev));
+	struct efx_ipsec_state *ipsec;
+	ssize_t rc = 0;
+
+	/* ipsec cannot be freed while its sysfs file exists */
+	ipsec = rcu_access_pointer(efx->ipsec);
+	if (!ipsec)
+		return 0;
+
+	mutex_lock(&ipsec->snap_lock);
+	if (off == 0 || !ipsec->snap) {
+		rc = efx_ipsec_sa_snapshot(ipsec);
+		if (rc)
+			goto out;
+	}
+	if (off < ipsec->snap_len) {
+		rc = min_t(size_t, count, ipsec->snap_len - off);
+		memcpy(buf, (char *)ipsec->snap + off, rc);
+	}
+out:
+	mutex_unlock(&ipsec->snap_lock);
+	return rc;
+}
+
+static struct bin_attribute bin_attr_ipsec_sa_stats = {
+	.attr = { .name = "ipsec_sa_stats", .mode = 0444 },
+	.read = ipsec_sa_stats_read,
+};
+
 int efx_ipsec_init(struct efx_nic *efx)
 {
-	return device_create_file(&efx->pci_dev->dev, &dev_attr_ipsec_enable);
+	struct efx_ipsec_state *ipsec;
+	int rc;
+
+	ipsec = kzalloc(sizeof(*ipsec), GFP_KERNEL);
+	if (!ipsec)
+		return -ENOMEM;
+	spin_lock_init(&ipsec->lock);
+	mutex_init(&ipsec->snap_lock);
+	rc = rhashtable_init(&ipsec->sa_ht, &efx_ipsec_sa_ht_params);
+	if (rc)
+		goto fail_ht;
+	rcu_assign_pointer(efx->ipsec, ipsec);
+
+	rc = device_create_file(&efx->pci_dev->dev, &dev_attr_ipsec_enable);
+	if (rc)
+		goto fail_enable;
+	rc = device_create_bin_file(&efx->pci_dev->dev, &bin_attr_ipsec_sa_stats);
+	if (rc)
+		goto fail_stats;
+	return 0;
+
+fail_stats:
+	device_remove_file(&efx->pci_dev->dev, &dev_attr_ipsec_enable);
+fail_enable:
+	RCU_INIT_POINTER(efx->ipsec, NULL);
+	rhashtable_destroy(&ipsec->sa_ht);
+fail_ht:
+	kfree(ipsec);
+	return rc;
+}
+
+static void efx_ipsec_sa_free(void *ptr, void *arg)
+{
+	kfree(ptr);
 }
 
 void efx_ipsec_fini(struct efx_nic *efx)
 {
+	struct efx_ipsec_state *ipsec;
+
+	device_remove_bin_file(&efx->pci_dev->dev, &bin_attr_ipsec_sa_stats);
 	device_remove_file(&efx->pci_dev->dev, &dev_attr_ipsec_enable);
+
+	ipsec = rcu_dereference_protected(efx->ipsec, true);
+	if (!ipsec)
+		return;
+	RCU_INIT_POINTER(efx->ipsec, NULL);
+	/* Wait for any efx_ipsec_update_sa_stats() still using it */
+	synchronize_net();
+	rhashtable_free_and_destroy(&ipsec->sa_ht, efx_ipsec_sa_free, NULL);
+	vfree(ipsec->snap);
+	kfree(ipsec);
 }
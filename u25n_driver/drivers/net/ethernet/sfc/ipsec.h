@@ -14,5 +14,7 @@
 int efx_ipsec_ioctl(struct efx_nic *efx, struct ifreq *ifr, int cmd);
 int efx_ipsec_init(struct efx_nic *efx);
 void efx_ipsec_fini(struct efx_nic *efx);
+void efx_ipsec_update_sa_stats(struct efx_nic *efx, u32 spi, u64 packets,
+			       u64 bytes);
 
 #endif
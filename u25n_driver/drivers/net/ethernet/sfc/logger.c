@@ -11,12 +11,16 @@
 #include <linux/moduleparam.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
 
 #include "mae.h"
 #include "emcdi.h"
 #include "logger.h"
 #include "mcdi_pcol_mae.h"
 #include "efx_devlink.h"
+#include "debugfs.h"
 
 bool check_logger_is_running(struct efx_nic *efx)
 {
@@ -56,46 +60,170 @@ fail:
 	return false;
 }
 
+/* PS log lines are kept in a byte ring with a single producer, the eMCDI
+ * channel, and readers serialised by read_mutex; head and tail are free
+ * running and each is written by one side only.  Lines that do not fit are
+ * dropped and counted rather than queued, so a slow reader cannot make the
+ * driver allocate.
+ */
+static void efx_logger_free(struct kref *ref)
+{
+	struct logger_info *logs = container_of(ref, struct logger_info, ref);
+
+	vfree(logs->ring);
+	kfree(logs);
+}
+
+static int efx_logger_open(struct inode *inode, struct file *file)
+{
+	struct logger_info *logs = container_of(file->private_data,
+						struct logger_info, miscdev);
+
+	kref_get(&logs->ref);
+	file->private_data = logs;
+	return nonseekable_open(inode, file);
+}
+
+static int efx_logger_release(struct inode *inode, struct file *file)
+{
+	struct logger_info *logs = file->private_data;
+
+	kref_put(&logs->ref, efx_logger_free);
+	return 0;
+}
+
+static bool efx_logger_readable(struct logger_info *logs)
+{
+	return READ_ONCE(logs->head) != READ_ONCE(logs->tail) ||
+	       READ_ONCE(logs->dead);
+}
+
+static ssize_t efx_logger_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct logger_info *logs = file->private_data;
+	unsigned int head, tail, off, len, n;
+	ssize_t rc;
+
+	if (mutex_lock_interruptible(&logs->read_mutex))
+		return -ERESTARTSYS;
+	while ((head = smp_load_acquire(&logs->head)) == logs->tail) {
+		mutex_unlock(&logs->read_mutex);
+		if (READ_ONCE(logs->dead))
+			return 0;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(logs->read_wq,
+					     efx_logger_readable(logs)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&logs->read_mutex))
+			return -ERESTARTSYS;
+	}
+
+	tail = logs->tail;
+	len = min_t(size_t, count, head - tail);
+	off = tail & (EFX_LOGGER_RING_SIZE - 1);
+	n = min(len, EFX_LOGGER_RING_SIZE - off);
+	if (copy_to_user(buf, logs->ring + off, n) ||
+	    copy_to_user(buf + n, logs->ring, len - n)) {
+		rc = -EFAULT;
+		goto out;
+	}
+	/* Release the space to the producer only once it is copied out */
+	smp_store_release(&logs->tail, tail + len);
+	rc = len;
+out:
+	mutex_unlock(&logs->read_mutex);
+	return rc;
+}
+
+static __poll_t efx_logger_poll(struct file *file, poll_table *wait)
+{
+	struct logger_info *logs = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &logs->read_wq, wait);
+	if (smp_load_acquire(&logs->head) != READ_ONCE(logs->tail))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (READ_ONCE(logs->dead))
+		mask |= EPOLLHUP;
+	return mask;
+}
+
+static const struct file_operations efx_logger_fops = {
+	.owner		= THIS_MODULE,
+	.open		= efx_logger_open,
+	.release	= efx_logger_release,
+	.read		= efx_logger_read,
+	.poll		= efx_logger_poll,
+	.llseek		= no_llseek,
+};
+
+#ifdef CONFIG_SFC_DEBUGFS
+static int efx_logger_debugfs_dump(struct seq_file *file, void *data)
+{
+	struct logger_info *logs = data;
+
+	seq_printf(file, "device /dev/%s\n", logs->name);
+	seq_printf(file, "lines %lu bytes %lu pending %u\n",
+		   READ_ONCE(logs->n_lines), READ_ONCE(logs->n_bytes),
+		   READ_ONCE(logs->head) - READ_ONCE(logs->tail));
+	seq_printf(file, "dropped lines %lu bytes %lu\n",
+		   READ_ONCE(logs->n_dropped), READ_ONCE(logs->n_dropped_bytes));
+	return 0;
+}
+
+static struct efx_debugfs_parameter efx_logger_debugfs[] = {
+	_EFX_RAW_PARAMETER(ps_log, efx_logger_debugfs_dump),
+	{NULL}
+};
+#endif
+
 void logger_init(struct efx_nic *efx ,struct logger_info *logs)
 {
-	efx->emcdi->logger_wq = create_workqueue("logger_workq");
-        if(!efx->emcdi->logger_wq) {
-                pr_err("%s:Failed to create logger work queue\n", __func__);
-                return;
-        }
-	
-        spin_lock_init(&logs->logger_lock);
-        mutex_init(&logs->logger_mutex);
-        rwlock_init(&logs->logger_rwlock);
-	
-        INIT_WORK(&logs->logger_work, logs_write_to_file);
-        logs->logger_q = kmalloc(sizeof(struct sk_buff_head), GFP_KERNEL);
-        if (!logs->logger_q) {
-                pr_err("%s: cannot allocate skb_buff_head\n", __func__);
-                return;
-        }
-	skb_queue_head_init(logs->logger_q);
+	int rc;
+
+	kref_init(&logs->ref);
+	mutex_init(&logs->read_mutex);
+	init_waitqueue_head(&logs->read_wq);
 
-	logs->fp = filp_open("/var/log/ps_dmesg.txt", O_WRONLY | O_CREAT | O_LARGEFILE | O_APPEND, 0644);
-        if (logs->fp == NULL) 
-        	printk("%s:Logs file creation failed\n", __func__);
+	logs->ring = vmalloc(EFX_LOGGER_RING_SIZE);
+	if (!logs->ring) {
+		pr_err("%s: cannot allocate log ring\n", __func__);
+		return;
+	}
 
+	snprintf(logs->name, sizeof(logs->name), "u25_ps_log_%s",
+		 pci_name(efx->pci_dev));
+	logs->miscdev.minor = MISC_DYNAMIC_MINOR;
+	logs->miscdev.name = logs->name;
+	logs->miscdev.fops = &efx_logger_fops;
+	rc = misc_register(&logs->miscdev);
+	if (rc)
+		pr_err("%s: cannot register %s, rc %d\n", __func__,
+		       logs->name, rc);
+	else
+		logs->registered = true;
+#ifdef CONFIG_SFC_DEBUGFS
+	efx_extend_debugfs_port(efx, logs, 0, efx_logger_debugfs);
+#endif
 }
 
 void logger_deinit(struct efx_nic *efx)
 {
-	 struct logger_info *logs;
-	 logs = efx->emcdi->logger;
-	 if(logs->logger_q) {
-                skb_queue_purge(logs->logger_q);
-                kfree(logs->logger_q);
-        }
-	filp_close(logs->fp, NULL);
-	flush_work(&logs->logger_work);
-        flush_workqueue(efx->emcdi->logger_wq);
-        destroy_workqueue(efx->emcdi->logger_wq);
-        efx->emcdi->logger = NULL;
-	kfree(logs);
+	struct logger_info *logs;
+
+	logs = efx->emcdi->logger;
+#ifdef CONFIG_SFC_DEBUGFS
+	efx_trim_debugfs_port(efx, efx_logger_debugfs);
+#endif
+	if (logs->registered)
+		misc_deregister(&logs->miscdev);
+	efx->emcdi->logger = NULL;
+	/* Readers still holding the device see EOF once drained */
+	WRITE_ONCE(logs->dead, true);
+	wake_up_interruptible(&logs->read_wq);
+	kref_put(&logs->ref, efx_logger_free);
 }
 
 int efx_emcdi_start_request_log(struct efx_nic *efx)
@@ -109,53 +237,35 @@ int efx_emcdi_start_request_log(struct efx_nic *efx)
 	return rc;
 }
 
-void logs_write_to_file(struct work_struct *work)
+int efx_emcdi_process_logs_message(struct efx_nic *efx, uint8_t *data,
+				   unsigned int length)
 {
-        struct logger_info *logger = container_of(work, struct logger_info, logger_work);
-        struct sk_buff *skb;
-        void *data;
-        mm_segment_t fs;
-
-	spin_lock_bh(&logger->logger_lock);
-
-        if(skb_queue_len(logger->logger_q) != 0 ) {
-		skb = skb_dequeue(logger->logger_q);
-		spin_unlock_bh(&logger->logger_lock);
-                if (!skb)
-                        return;
-                data = skb->data;
-                fs = get_fs();
-                set_fs(KERNEL_DS);
-                write_lock(&logger->logger_rwlock);
-                if (kernel_write(logger->fp, data, strlen((char *)data), &logger->fp->f_pos) < 0) {
-                        write_unlock(&logger->logger_rwlock);
-                        return;
-                } else {
-                        set_fs(fs);
-                }
-		write_unlock(&logger->logger_rwlock);
-		kfree_skb(skb);
-        } else
-		spin_unlock_bh(&logger->logger_lock);
-}
+	struct logger_info *logs = efx->emcdi->logger;
+	unsigned int head, tail, off, n;
 
-int efx_emcdi_process_logs_message(struct efx_nic *efx, uint8_t *data, uint8_t length)
-{
-	struct sk_buff *skb;
-	struct logger_info *logs;
+	if (!logs)
+		return -ENODEV;
+	length = strnlen((char *)data, length);
+	if (!length)
+		return 0;
 
-	skb = alloc_skb(PKT_BUFF_SZ, GFP_KERNEL);
-        if (skb == NULL) {
-		pr_err("%s: cannot allocate skb for logs\n", __func__);
-                return -ENOMEM;
-        }
-	
-	logs = efx->emcdi->logger;
-	memcpy(skb->data , data, length);
-	spin_lock(&logs->logger_lock);
-        skb_queue_tail(logs->logger_q, skb);
-	spin_unlock(&logs->logger_lock);
-        queue_work(efx->emcdi->logger_wq, &logs->logger_work);
+	head = logs->head;
+	tail = smp_load_acquire(&logs->tail);
+	if (!logs->ring || EFX_LOGGER_RING_SIZE - (head - tail) < length) {
+		logs->n_dropped++;
+		logs->n_dropped_bytes += length;
+		return -ENOSPC;
+	}
+
+	off = head & (EFX_LOGGER_RING_SIZE - 1);
+	n = min(length, EFX_LOGGER_RING_SIZE - off);
+	memcpy(logs->ring + off, data, n);
+	memcpy(logs->ring, data + n, length - n);
+	/* Publish the line before the new head */
+	smp_store_release(&logs->head, head + length);
+	logs->n_lines++;
+	logs->n_bytes += length;
+	wake_up_interruptible(&logs->read_wq);
 
 	return 0;
 }
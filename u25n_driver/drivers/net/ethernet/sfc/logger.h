@@ -10,25 +10,56 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-#define PKT_BUFF_SZ   1024
+#include <linux/kref.h>
+#include <linux/miscdevice.h>
+#include <linux/wait.h>
 
+/* Bytes of PS log text buffered for the reader; a power of 2 */
+#define EFX_LOGGER_RING_SIZE	(256 * 1024)
+
+/**
+ * struct logger_info - PS log stream of one U25 function
+ * @ref: Held by the driver and by each open reader
+ * @ring: EFX_LOGGER_RING_SIZE bytes of log text
+ * @head: Free-running write index; written only by the eMCDI channel
+ * @tail: Free-running read index; written only by readers
+ * @read_mutex: Serialises readers
+ * @read_wq: Readers waiting for log text
+ * @dead: The function is going away; readers get EOF once drained
+ * @miscdev: Character device readers open, /dev/@name
+ * @registered: Whether @miscdev is registered
+ * @name: Name of @miscdev
+ * @n_lines: Log lines buffered
+ * @n_bytes: Bytes buffered
+ * @n_dropped: Log lines dropped because the ring was full
+ * @n_dropped_bytes: Bytes dropped because the ring was full
+ * @pf_id: PF the PS logger application reports to
+ */
 struct logger_info {
-        struct file *fp;
-        struct work_struct logger_work;
-        struct sk_buff_head *logger_q;
-        spinlock_t logger_lock;
-        struct mutex logger_mutex;
-        rwlock_t logger_rwlock;
-        uint32_t pf_id;
+	struct kref ref;
+	char *ring;
+	unsigned int head;
+	unsigned int tail;
+	struct mutex read_mutex;
+	wait_queue_head_t read_wq;
+	bool dead;
+	struct miscdevice miscdev;
+	bool registered;
+	char name[40];
+	unsigned long n_lines;
+	unsigned long n_bytes;
+	unsigned long n_dropped;
+	unsigned long n_dropped_bytes;
+	uint32_t pf_id;
 };
 
 bool check_logger_is_running(struct efx_nic *efx );
 void logger_init(struct efx_nic *efx ,struct logger_info *logs);
 void logger_deinit(struct efx_nic *efx);
 int efx_emcdi_start_request_log(struct efx_nic *efx);
-int efx_emcdi_process_logs_message(struct efx_nic *efx, uint8_t *data, uint8_t length);
+int efx_emcdi_process_logs_message(struct efx_nic *efx, uint8_t *data,
+				   unsigned int length);
 int efx_emcdi_stop_logs(struct efx_nic *efx);
-void logs_write_to_file(struct work_struct *work);
 
 #endif /* LOGGER_H */
 
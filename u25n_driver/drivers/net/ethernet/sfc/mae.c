@@ -1496,23 +1496,28 @@ int efx_mae_delete_rule(struct efx_nic *efx, u32 id)
 }
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
-int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *match,
-                struct efx_legacy_action_set *act,
-                u32 prio, u32 acts_id, u32 *id)
+/* Map a FirewallSdnetReturnType status reported by the PS to an errno */
+static int efx_legacy_status_to_errno(int status)
 {
-    MCDI_DECLARE_BUF(inbuf, MC_CMD_MAE_ACTION_RULE_INSERT_IN_LEN(FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN));
-    MCDI_DECLARE_BUF(outbuf, MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_LEN);
-    MCDI_DECLARE_STRUCT_PTR(match_crit);
-    //MCDI_DECLARE_STRUCT_PTR(response);
-    size_t outlen;
-    int rc;
-    int idd;
-
-    if (!id)
-        return -EINVAL;
-
-    match_crit = inbuf;
+    switch (status) {
+    case FIREWALL_SDNET_SUCCESS:
+        return 0;
+    case FIREWALL_SDNET__ERR_DUPLICATE_FOUND:
+        return -EEXIST;
+    case FIREWALL_SDNET__ERR_FULL:
+        return -ENOMEM;
+    case FIREWALL_SDNET__ERR_KEY_NOT_FOUND:
+    case FIREWALL_SDNET__ERR_LOOKUP_NOT_FOUND:
+        return -ENOENT;
+    default:
+        return -EIO;
+    }
+}
 
+static void efx_legacy_populate_match(MCDI_DECLARE_STRUCT_PTR(match_crit),
+                const struct efx_legacy_match *match,
+                const struct efx_legacy_action_set *act)
+{
     MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_INGRESS_PORT,
                     match->value.ingress_port);
 
@@ -1558,7 +1563,6 @@ int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *m
             match->value.dst_ip);
     MCDI_STRUCT_SET_DWORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_DST_IP4_BE_MASK,
             match->mask.dst_ip);
-    //printk(KERN_ERR "ip dst:%08x \n", match->value.dst_ip);
 
     /* SRC_PORT */
     MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_L4_SPORT_BE,
@@ -1572,6 +1576,9 @@ int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *m
     MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_L4_DPORT_BE_MASK,
                 match->mask.dport);
 
+    if (!act)
+        return;
+
     /* ACTION_FLAG */
     MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_ACTION_FLAG,
                  act->action_flag);
@@ -1581,6 +1588,22 @@ int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *m
                  act->action_flag);
     MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_ACTION_FLAG2,
                  act->action_flag);
+}
+
+int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *match,
+                struct efx_legacy_action_set *act,
+                u32 prio, u32 acts_id, u32 *id)
+{
+    MCDI_DECLARE_BUF(inbuf, MC_CMD_MAE_ACTION_RULE_INSERT_IN_LEN(FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN));
+    MCDI_DECLARE_BUF(outbuf, MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_LEN);
+    size_t outlen;
+    int rc;
+    int idd;
+
+    if (!id)
+        return -EINVAL;
+
+    efx_legacy_populate_match(inbuf, match, act);
 
     rc = efx_emcdi_rpc(efx, MC_CMD_FIREWALL_RULE_ADD, inbuf, sizeof(inbuf),
               outbuf, sizeof(outbuf), &outlen, EMCDI_TYPE_FIREWALL);
@@ -1592,84 +1615,20 @@ int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *m
 
     pr_info("Rule insertion status:%s\n",FirewallSdnetReturnTypeToString(idd));
 
-    if (idd == FIREWALL_SDNET_CAM_ERR_DUPLICATE_FOUND)
-        return -EEXIST;
-    if (idd == FIREWALL_SDNET_CAM_ERR_FULL)
-        return -ENOMEM;
-    return -idd;
-
-    return 0;
+    return efx_legacy_status_to_errno(idd);
 }
 
 int delete_legacy_rule(struct efx_nic *efx, const struct efx_legacy_match *match, u32 *id)
 {
     MCDI_DECLARE_BUF(inbuf, MC_CMD_MAE_ACTION_RULE_INSERT_IN_LEN(FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN));
     MCDI_DECLARE_BUF(outbuf, MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_LEN);
-    MCDI_DECLARE_STRUCT_PTR(match_crit);
     size_t outlen;
     int rc, idd;
 
     if (!id)
         return -EINVAL;
 
-    match_crit = inbuf;
-    MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_INGRESS_PORT,
-                    match->value.ingress_port);
-    MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_INGRESS_PORT_MASK,
-                 match->mask.ingress_port);
-    /* CHAIN_INDEX */
-    MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_CHAIN_IDX, 0);
-                // match->value.chain_index);
-    MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_CHAIN_IDX_MASK,
-                 match->mask.chain_index);
-
-    /* IP_PROTO */
-    MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_IP_PROTO,
-                 match->value.ip_proto);
-    MCDI_STRUCT_SET_BYTE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_IP_PROTO_MASK,
-                 match->mask.ip_proto);
-
-    /* ETH_PROTO */
-    MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_ETH_PROTO,
-                    match->value.n_proto);
-    MCDI_STRUCT_SET_WORD_BE(match_crit, MAE_FIELD_MASK_VALUE_PAIRS_V2_ETHER_TYPE_BE_MASK,
-                    match->mask.n_proto);
-
-    /* SRC_IP IPV6 */
-    memcpy(MCDI_STRUCT_PTR(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_SRC_IP6_BE),
-                   &match->value.src_ip6, sizeof(struct in6_addr));
-    memcpy(MCDI_STRUCT_PTR(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_SRC_IP6_BE_MASK),
-                   &match->mask.src_ip6, sizeof(struct in6_addr));
-
-    /* DST_IP IPV6 */
-    memcpy(MCDI_STRUCT_PTR(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_DST_IP6_BE),
-                   &match->value.dst_ip6, sizeof(struct in6_addr));
-    memcpy(MCDI_STRUCT_PTR(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_DST_IP6_BE_MASK),
-                   &match->mask.dst_ip6, sizeof(struct in6_addr));
-
-      /* SRC_IP IPV4 */
-    MCDI_STRUCT_SET_DWORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_SRC_IP4_BE,
-            match->value.src_ip);
-    MCDI_STRUCT_SET_DWORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_SRC_IP4_BE_MASK,
-            match->mask.src_ip);
-
-    /* DST_IP IPV4 */
-    MCDI_STRUCT_SET_DWORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_DST_IP4_BE,
-            match->value.dst_ip);
-    MCDI_STRUCT_SET_DWORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_DST_IP4_BE_MASK,
-            match->mask.dst_ip);
-
-    /* SRC_PORT */
-    MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_L4_SPORT_BE,
-                match->value.sport);
-    MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_L4_SPORT_BE_MASK,
-                match->mask.sport);
-
-    /* DST_PORT */
-    MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_L4_DPORT_BE,
-                match->value.dport);
-    MCDI_STRUCT_SET_WORD_BE(match_crit, FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_L4_DPORT_BE_MASK,
-                match->mask.dport);
+    efx_legacy_populate_match(inbuf, match, NULL);
 
     rc = efx_emcdi_rpc(efx, MC_CMD_FIREWALL_RULE_DEL, inbuf, sizeof(inbuf),
               outbuf, sizeof(outbuf), &outlen, EMCDI_TYPE_FIREWALL);
@@ -1679,24 +1638,130 @@ int delete_legacy_rule(struct efx_nic *efx, const struct efx_legacy_match *match
     if (outlen < sizeof(outbuf))
         return -EIO;
     idd = MCDI_DWORD(outbuf, FIREWALL_ACTION_RULE_INSERT_OUT_AR_ID);
-    return idd;
+    return efx_legacy_status_to_errno(idd);
+}
+
+/* Issue one batched add or delete for up to
+ * MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_MAXNUM rules.  On success each entry
+ * of @rcs holds the errno for the corresponding rule.
+ */
+static int efx_legacy_rule_batch_rpc(struct efx_nic *efx, unsigned int cmd,
+                const struct efx_legacy_match **matches,
+                struct efx_legacy_action_set **acts,
+                unsigned int count, int *rcs)
+{
+    MCDI_DECLARE_BUF(outbuf, MC_CMD_FIREWALL_RULE_BATCH_OUT_LENMAX);
+    size_t inlen = MC_CMD_FIREWALL_RULE_BATCH_IN_LEN(count);
+    efx_dword_t *inbuf;
+    unsigned int i;
+    size_t outlen;
+    int rc;
+
+    inbuf = kzalloc(inlen, GFP_KERNEL);
+    if (!inbuf)
+        return -ENOMEM;
+
+    MCDI_SET_DWORD(inbuf, FIREWALL_RULE_BATCH_IN_COUNT, count);
+    for (i = 0; i < count; i++)
+        efx_legacy_populate_match(MCDI_ARRAY_STRUCT_PTR(inbuf,
+                        FIREWALL_RULE_BATCH_IN_RULES, i),
+                matches[i], acts ? acts[i] : NULL);
+
+    rc = efx_emcdi_rpc(efx, cmd, inbuf, inlen, outbuf, sizeof(outbuf),
+              &outlen, EMCDI_TYPE_FIREWALL);
+    kfree(inbuf);
+    if (rc)
+        return rc;
+    if (outlen < MC_CMD_FIREWALL_RULE_BATCH_OUT_LEN(count))
+        return -EIO;
 
+    for (i = 0; i < count; i++)
+        rcs[i] = efx_legacy_status_to_errno(MCDI_ARRAY_DWORD(outbuf,
+                        FIREWALL_RULE_BATCH_OUT_STATUS, i));
     return 0;
 }
 
-int efx_legacy_firewall_caps(struct efx_nic *efx)
+/* Add or remove @count rules using as few eMCDI round trips as possible.
+ * The per-rule result is stored in @rcs; the return value is only non-zero
+ * if the batch could not be issued at all.  PS images that predate the
+ * batch commands are handled by falling back to one RPC per rule: for good
+ * if the PS rejects the command as unknown, or for the rest of this call if
+ * it does not answer it at all.
+ */
+static int efx_legacy_rule_batch(struct efx_nic *efx, bool insert,
+                const struct efx_legacy_match **matches,
+                struct efx_legacy_action_set **acts,
+                unsigned int count, int *rcs)
+{
+    unsigned int cmd = insert ? MC_CMD_FIREWALL_RULE_ADD_BATCH :
+                                MC_CMD_FIREWALL_RULE_DEL_BATCH;
+    unsigned int done, chunk, i;
+    bool no_batch = false;
+    u32 id = 0;
+    int rc;
+
+    for (done = 0; done < count; done += chunk) {
+        chunk = min_t(unsigned int, count - done,
+                  MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_MAXNUM);
+        if (!efx->legacy_fw_no_batch && !no_batch) {
+            rc = efx_legacy_rule_batch_rpc(efx, cmd, matches + done,
+                            acts ? acts + done : NULL,
+                            chunk, rcs + done);
+            if (!rc)
+                continue;
+            if (rc == -ENOSYS || rc == -EOPNOTSUPP) {
+                /* Unknown command: this PS predates batching */
+                netif_info(efx, drv, efx->net_dev,
+                       "firewall batch commands not supported, using single rule commands\n");
+                efx->legacy_fw_no_batch = true;
+            } else if (rc == -ETIMEDOUT) {
+                /* A PS that drops unknown commands never answers */
+                netif_warn(efx, drv, efx->net_dev,
+                       "firewall batch command timed out, using single rule commands\n");
+                no_batch = true;
+            } else {
+                return rc;
+            }
+        }
+        for (i = done; i < done + chunk; i++)
+            rcs[i] = insert ?
+                 efx_legacy_insert_rule(efx, matches[i], acts[i],
+                            EFX_FIREWALL_PRIO, 0, &id) :
+                 delete_legacy_rule(efx, matches[i], &id);
+    }
+    return 0;
+}
+
+int efx_legacy_insert_rule_batch(struct efx_nic *efx,
+                const struct efx_legacy_match **matches,
+                struct efx_legacy_action_set **acts,
+                unsigned int count, int *rcs)
+{
+    return efx_legacy_rule_batch(efx, true, matches, acts, count, rcs);
+}
+
+int efx_legacy_delete_rule_batch(struct efx_nic *efx,
+                const struct efx_legacy_match **matches,
+                unsigned int count, int *rcs)
+{
+    return efx_legacy_rule_batch(efx, false, matches, NULL, count, rcs);
+}
+
+int efx_legacy_firewall_caps(struct efx_nic *efx, u32 *max_rules)
 {
     MCDI_DECLARE_BUF(inbuf, MC_CMD_MAE_ACTION_RULE_INSERT_IN_LEN(FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN));
-    MCDI_DECLARE_BUF(outbuf, MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_LEN);
-    MCDI_DECLARE_STRUCT_PTR(match_crit);
+    MCDI_DECLARE_BUF(outbuf, MC_CMD_FIREWALL_CAPS_OUT_LEN);
     size_t outlen;
     int rc;
-    match_crit = inbuf;
 
     rc = efx_emcdi_rpc(efx, MC_CMD_FIREWALL_CAPS, inbuf, sizeof(inbuf),
               outbuf, sizeof(outbuf), &outlen, EMCDI_TYPE_FIREWALL);
     if (rc)
             return rc;
+    /* Older PS images reply without filling in the CAM size */
+    *max_rules = 0;
+    if (outlen >= MC_CMD_FIREWALL_CAPS_OUT_LEN)
+            *max_rules = MCDI_DWORD(outbuf, FIREWALL_CAPS_OUT_MAX_RULES);
     return 0;
 }
 #endif
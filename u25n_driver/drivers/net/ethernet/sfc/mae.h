@@ -94,5 +94,12 @@ int efx_legacy_insert_rule(struct efx_nic *efx, const struct efx_legacy_match *m
                                 struct efx_legacy_action_set *act,
                                 u32 prio, u32 acts_id, u32 *id);
 int delete_legacy_rule(struct efx_nic *efx, const struct efx_legacy_match *match, u32 *id);
-int efx_legacy_firewall_caps(struct efx_nic *efx);
+int efx_legacy_insert_rule_batch(struct efx_nic *efx,
+                                const struct efx_legacy_match **matches,
+                                struct efx_legacy_action_set **acts,
+                                unsigned int count, int *rcs);
+int efx_legacy_delete_rule_batch(struct efx_nic *efx,
+                                const struct efx_legacy_match **matches,
+                                unsigned int count, int *rcs);
+int efx_legacy_firewall_caps(struct efx_nic *efx, u32 *max_rules);
 #endif
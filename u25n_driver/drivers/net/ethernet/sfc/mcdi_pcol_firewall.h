@@ -17,12 +17,20 @@
 #define MC_CMD_FIREWALL_RULE_ADD 0x300
 #define MC_CMD_FIREWALL_RULE_DEL 0x301
 #define MC_CMD_FIREWALL_CAPS 	 0x302
+#define MC_CMD_FIREWALL_RULE_ADD_BATCH 0x303
+#define MC_CMD_FIREWALL_RULE_DEL_BATCH 0x304
 
 /* MC_CMD_MAE_ACTION_RULE_INSERT_OUT msgresponse */
 #define    MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_LEN 4
 #define       MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_AR_ID_OFST 0
 #define       MC_CMD_FIREWALL_ACTION_RULE_INSERT_OUT_AR_ID_LEN 4
 
+/* MC_CMD_FIREWALL_CAPS_OUT msgresponse */
+#define    MC_CMD_FIREWALL_CAPS_OUT_LEN 4
+/* Number of rules the firewall CAM can hold; zero if not reported */
+#define       MC_CMD_FIREWALL_CAPS_OUT_MAX_RULES_OFST 0
+#define       MC_CMD_FIREWALL_CAPS_OUT_MAX_RULES_LEN 4
+
 #define    FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN 100
 #define       FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_INGRESS_PORT_OFST 0
 #define       FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_INGRESS_PORT_LEN 1
@@ -131,4 +139,25 @@
 #define       FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_ACTION_FLAG2_WIDTH 8
 
 /* FIREWALL_FIELD_MASK_VALUE_PAIRS_V2 structuredef ends */
+
+/* MC_CMD_FIREWALL_RULE_ADD_BATCH/MC_CMD_FIREWALL_RULE_DEL_BATCH msgrequest:
+ * a count followed by that many FIREWALL_FIELD_MASK_VALUE_PAIRS_V2 entries,
+ * sized to fit a single eMCDI packet.
+ */
+#define    MC_CMD_FIREWALL_RULE_BATCH_IN_LEN(num) (4+FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN*(num))
+#define    MC_CMD_FIREWALL_RULE_BATCH_IN_LENMAX MC_CMD_FIREWALL_RULE_BATCH_IN_LEN(MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_MAXNUM)
+#define       MC_CMD_FIREWALL_RULE_BATCH_IN_COUNT_OFST 0
+#define       MC_CMD_FIREWALL_RULE_BATCH_IN_COUNT_LEN 4
+#define       MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_OFST 4
+#define       MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_LEN FIREWALL_FIELD_MASK_VALUE_PAIRS_V2_LEN
+#define       MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_MAXNUM 10
+
+/* MC_CMD_FIREWALL_RULE_BATCH_OUT msgresponse: one FirewallSdnetReturnType
+ * status per rule, in request order.
+ */
+#define    MC_CMD_FIREWALL_RULE_BATCH_OUT_LEN(num) (4*(num))
+#define    MC_CMD_FIREWALL_RULE_BATCH_OUT_LENMAX MC_CMD_FIREWALL_RULE_BATCH_OUT_LEN(MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_MAXNUM)
+#define       MC_CMD_FIREWALL_RULE_BATCH_OUT_STATUS_OFST 0
+#define       MC_CMD_FIREWALL_RULE_BATCH_OUT_STATUS_LEN 4
+#define       MC_CMD_FIREWALL_RULE_BATCH_OUT_STATUS_MAXNUM MC_CMD_FIREWALL_RULE_BATCH_IN_RULES_MAXNUM
 #endif /* MCDI_PCOL_FIREWALL_H */
@@ -2649,9 +2649,17 @@
 
 /* MC_CMD_MAE_COUNTER_ACK */
 
-#define	   MC_CMD_MAE_COUNTERS_ACK_IN_LEN 1 
+#define	   MC_CMD_MAE_COUNTERS_ACK_IN_LEN 4 
 #define    MC_CMD_MAE_COUNTERS_ACK_IN_STATUS_OFST 0 
 #define    MC_CMD_MAE_COUNTERS_ACK_IN_STATUS_LEN  1 
+#define    MC_CMD_MAE_COUNTERS_ACK_IN_FLAGS_OFST 1 
+#define    MC_CMD_MAE_COUNTERS_ACK_IN_FLAGS_LEN  1 
+/* The receiver lost track of the stream; credits count from the next packet */
+#define        MC_CMD_MAE_COUNTERS_ACK_IN_RESYNC_LBN 0 
+#define        MC_CMD_MAE_COUNTERS_ACK_IN_RESYNC_WIDTH 1 
+/* Packets the sender may have in flight beyond the acknowledged seq_num */
+#define    MC_CMD_MAE_COUNTERS_ACK_IN_CREDITS_OFST 2 
+#define    MC_CMD_MAE_COUNTERS_ACK_IN_CREDITS_LEN  2 
 
 /* MC_CMD_REQUEST_LOGS */
 #define MC_CMD_START_REQUEST_LOGGER 0x17e
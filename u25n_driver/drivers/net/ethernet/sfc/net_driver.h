@@ -302,6 +302,8 @@ struct efx_tx_buffer {
  *	as an index in to %efx_channel->tx_queues
  * @csum_offload: Is checksum offloading enabled for this queue?
  * @tso_version: Version of TSO in use for this queue.
+ * @mport_tags: U25 mport VLAN tags the hardware is inserting on this queue,
+ *	as (outer << 16 | inner), or 0 if none
  * @tso_encap: Is encapsulated TSO supported? Supported in TSOv2 on 8000 series.
  * @channel: The associated channel
  * @core_txq: The networking core TX queue structure
@@ -418,6 +420,7 @@ struct efx_tx_queue {
 	unsigned int insert_count ____cacheline_aligned_in_smp;
 	unsigned int write_count;
 	unsigned int packet_write_count;
+	u32 mport_tags;
 	unsigned int old_read_count;
 	unsigned int tso_bursts;
 	unsigned int tso_long_headers;
@@ -1559,6 +1562,8 @@ struct efx_mtd {
  * @proxy_admin_mutex: Mutex for serialising proxy auth admin shutdown
  * @proxy_admin_stop_work: Work item for stopping proxy auth from atomic context.
  * @debugfs_symlink_mutex: Mutex to protect access to debugfs symlinks.
+ * @ipsec: U25 IPsec offload state (SA statistics)
+ * @legacy_fw_no_batch: PS does not support batched firewall rule commands
  * This is stored in the private area of the &struct net_device.
  */
 struct efx_nic {
@@ -1865,9 +1870,9 @@ struct efx_nic {
 #ifdef CONFIG_SFC_DEBUGFS
 	struct mutex debugfs_symlink_mutex;
 #endif
-	struct workqueue_struct *cnt_queue;
+	struct efx_ipsec_state __rcu *ipsec;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
-	u32 flow_id;
+	bool legacy_fw_no_batch;
 #endif
 };
 
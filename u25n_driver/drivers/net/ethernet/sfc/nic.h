@@ -388,6 +388,8 @@ enum {
  * @have_pf_mport: pf_mport valid or not
  * @vf_rep: VF representor netdevices
  * @vf_rep_lock: lock for VF representors
+ * @vfrep_by_mport: VF representors indexed by m-port label, for RX demux.
+ *	Entries are RCU-protected; %U25_MPORT_LABELS in size
  * @rep_count: VF representor count
  * @udp_tunnel_list: udp tunnels list
  * @rxfilter_counter: filter ID for counter
@@ -447,6 +449,7 @@ struct efx_ef10_nic_data {
 	u32 have_pf_mport;
 	struct net_device **vf_rep;
 	spinlock_t vf_reps_lock; /* Synchronises 'all-VFreps' operations */
+	struct efx_vfrep __rcu **vfrep_by_mport;
 	unsigned int rep_count; /* usually but not always efx->vf_count */
 	struct list_head udp_tunnel_list;
 	u32 rxfilter_counter;
@@ -466,18 +466,23 @@ void __efx_rx_packet(struct efx_channel *channel)
 		if (nic_data->mode == U25_MODE_SWITCHDEV) {
 			rc = efx_u25_rx_packet(channel, &is_from_network);
 			if (!rc) {
+				/* Buffers handed to a representor skb have
+				 * had their page taken, so this only frees
+				 * what was not consumed.
+				 */
 				if (!is_from_network) {
 					efx_free_rx_buffers(efx_channel_get_rx_queue(channel),
-                                                rx_buf, 1);
+                                                rx_buf, channel->rx_pkt_n_frags);
 					goto out;
 				}
-			} else {
-				/* TODO hook this up to SW stats reporting (when that's fully
-				 * implemented).
+				/* The mport tags were stripped by moving the
+				 * start of the frame.
 				 */
+				eh = efx_rx_buf_va(rx_buf);
+			} else {
 				channel->n_rx_mport_bad++;
 				efx_free_rx_buffers(efx_channel_get_rx_queue(channel),
-						rx_buf, 1);
+						rx_buf, channel->rx_pkt_n_frags);
 				goto out;
 			}
 		}
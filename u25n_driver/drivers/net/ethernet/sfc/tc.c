@@ -38,6 +38,7 @@
 #include "debugfs.h"
 #include "ipsec.h"
 #include "linkmode.h"
+#include "efx_ioctl.h"
 
 #define le8_to_cpu(v) (v)
 #define cpu_to_le8(v) (v)
@@ -251,6 +252,12 @@ const static struct rhashtable_params efx_legacy_match_action_ht_params = {
 	.key_offset 	= offsetof(struct efx_legacy_flow_rule, cookie),
 	.head_offset    = offsetof(struct efx_legacy_flow_rule, linkage),
 };
+
+const static struct rhashtable_params efx_legacy_fw_match_ht_params = {
+	.key_len	= sizeof(struct efx_legacy_match),
+	.key_offset	= offsetof(struct efx_legacy_flow_rule, match),
+	.head_offset	= offsetof(struct efx_legacy_flow_rule, match_linkage),
+};
 #endif
 
 static void efx_tc_update_encap(struct efx_nic *efx,
@@ -557,8 +564,6 @@ done:
 	return NOTIFY_DONE;
 }
 
-static void efx_tc_counter_work(struct work_struct *work);
-
 static struct efx_tc_counter *efx_tc_flower_allocate_counter(struct efx_nic *efx)
 {
 	struct efx_tc_counter *cnt;
@@ -569,10 +574,8 @@ static struct efx_tc_counter *efx_tc_flower_allocate_counter(struct efx_nic *efx
 		return ERR_PTR(-ENOMEM);
 
 	spin_lock_init(&cnt->lock);
-	INIT_WORK(&cnt->work, efx_tc_counter_work);
-//	INIT_WORK(&cnt->work, efx_tc_counter_work);
+	u64_stats_init(&cnt->syncp);
 	cnt->touched = jiffies;
-	cnt->tc = efx->tc;
 
 
 	rc = efx_mae_allocate_counter(efx, cnt);
@@ -624,13 +627,6 @@ static void efx_tc_flower_release_counter(struct efx_nic *efx,
 	 * comments on CT-8026, for further discussion.
 	 */
 	synchronize_rcu();
-//	rc = cancel_work(&cnt->work);
-//	if (rc)
-//		netif_warn(efx, hw, efx->net_dev,
-//				"Failed to cancel MAE counter work , rc %d\n",
-//				 rc);
-	//flush_workqueue(efx->cnt_queue);
-	flush_work(&cnt->work);
 	EFX_WARN_ON_PARANOID(spin_is_locked(&cnt->lock));
 	kfree(cnt);
 }
@@ -1249,6 +1245,62 @@ static void efx_legacy_tc_free(void *ptr, void *arg)
         delete_legacy_rule(efx, &rule->match, &rule->fw_id);
         kfree(rule);
 }
+
+struct efx_legacy_tc_flush {
+	struct efx_nic *efx;
+	struct efx_legacy_flow_rule **rules;
+	unsigned int n_rules, max_rules;
+};
+
+static void efx_legacy_tc_collect(void *ptr, void *arg)
+{
+	struct efx_legacy_tc_flush *flush = arg;
+
+	if (flush->n_rules < flush->max_rules)
+		flush->rules[flush->n_rules++] = ptr;
+	else
+		efx_legacy_tc_free(ptr, flush->efx);
+}
+
+/* Remove any legacy firewall rules left at teardown with batched deletes
+ * rather than one eMCDI round trip per rule.
+ */
+static void efx_legacy_tc_free_all(struct efx_nic *efx)
+{
+	struct rhashtable *ht = &efx->tc->legacy_match_action_ht;
+	const struct efx_legacy_match **matches = NULL;
+	struct efx_legacy_tc_flush flush = {
+		.efx = efx,
+	};
+	unsigned int i;
+	int *rcs = NULL;
+
+	flush.max_rules = atomic_read(&ht->nelems);
+	if (flush.max_rules) {
+		flush.rules = kcalloc(flush.max_rules, sizeof(*flush.rules),
+				      GFP_KERNEL);
+		matches = kcalloc(flush.max_rules, sizeof(*matches),
+				  GFP_KERNEL);
+		rcs = kcalloc(flush.max_rules, sizeof(*rcs), GFP_KERNEL);
+		if (!flush.rules || !matches || !rcs)
+			flush.max_rules = 0;
+	}
+	rhashtable_free_and_destroy(ht, efx_legacy_tc_collect, &flush);
+
+	if (flush.n_rules) {
+		netif_err(efx, drv, efx->net_dev,
+			  "%u firewall rules still present at teardown, removing\n",
+			  flush.n_rules);
+		for (i = 0; i < flush.n_rules; i++)
+			matches[i] = &flush.rules[i]->match;
+		efx_legacy_delete_rule_batch(efx, matches, flush.n_rules, rcs);
+		for (i = 0; i < flush.n_rules; i++)
+			kfree(flush.rules[i]);
+	}
+	kfree(rcs);
+	kfree(matches);
+	kfree(flush.rules);
+}
 #endif
 
 /* At teardown time, all TC filter rules (and thus all resources they created)
@@ -1282,8 +1334,6 @@ static void efx_tc_counter_free(void *ptr, void *__unused)
 	 * threads could still be obtaining new pointers to *cnt if they can
 	 * race against this function at all.
 	 */
-	//flush_workqueue(efx->cnt_queue);
-	flush_work(&cnt->work);
 	EFX_WARN_ON_PARANOID(spin_is_locked(&cnt->lock));
 	kfree(cnt);
 }
@@ -1333,18 +1383,95 @@ static int efx_tc_probe_channel(struct efx_channel *channel)
 
 	return 0;
 }
-#if 0
-static int efx_tc_send_counter_ack(struct efx_nic *efx, uint16_t seq_no)
+
+/* ACK type for counter streams the PS sends without waiting for credits.
+ * Only the MAE stream is paced; the PS ignores IPsec counter ACKs.
+ */
+#define EFX_TC_CTR_UNPACED	EMCDI_HEADER_TYPE_CONTROL
+
+/* Acknowledge everything up to (but not including) @stream->next_seq and
+ * grant the PS another EFX_TC_CTR_CREDITS packets beyond that.
+ */
+static void efx_tc_send_counter_ack(struct efx_nic *efx,
+				    struct efx_tc_ctr_stream *stream,
+				    u8 type, bool resync)
 {
-	int rc;
 	MCDI_DECLARE_BUF(inbuf, MC_CMD_MAE_COUNTERS_ACK_IN_LEN);
+	int rc;
 
-        MCDI_SET_BYTE(inbuf, MAE_COUNTERS_ACK_IN_STATUS, 1);
-        rc = efx_emcdi_rpc_send_counter_ack(efx, inbuf, sizeof(inbuf), seq_no);
+	if (type == EFX_TC_CTR_UNPACED)
+		return;
 
-	return rc;
+	MCDI_SET_BYTE(inbuf, MAE_COUNTERS_ACK_IN_STATUS, 1);
+	MCDI_SET_BYTE(inbuf, MAE_COUNTERS_ACK_IN_FLAGS,
+		      resync << MC_CMD_MAE_COUNTERS_ACK_IN_RESYNC_LBN);
+	MCDI_SET_WORD(inbuf, MAE_COUNTERS_ACK_IN_CREDITS, EFX_TC_CTR_CREDITS);
+	rc = efx_emcdi_rpc_send_counter_ack(efx, inbuf, sizeof(inbuf), type,
+					    stream->next_seq - 1);
+	if (rc) {
+		stream->n_ack_fail++;
+		if (net_ratelimit())
+			netif_err(efx, drv, efx->net_dev,
+				  "Failed to send counter ack packet, rc=%d.\n",
+				  rc);
+		return;
+	}
+	stream->unacked = 0;
+}
+
+/* Account for counter packet @seq_no on @stream, and acknowledge it once
+ * half the PS's credits have been used, so that it is never left waiting
+ * while an ACK is in flight.  Streams with @ack_type %EFX_TC_CTR_UNPACED
+ * are only checked for gaps.
+ */
+static void efx_tc_ctr_stream_rx(struct efx_nic *efx,
+				 struct efx_tc_ctr_stream *stream,
+				 u8 ack_type, u16 seq_no)
+{
+	s16 gap;
+
+	stream->n_packets++;
+	if (!stream->synced) {
+		stream->synced = true;
+		stream->next_seq = seq_no + 1;
+		efx_tc_send_counter_ack(efx, stream, ack_type, true);
+		return;
+	}
+
+	gap = (s16)(seq_no - stream->next_seq);
+	if (gap < -EFX_TC_CTR_CREDITS) {
+		/* A reordered packet can't be more than one credit window
+		 * old, so the PS must have restarted its sequence (e.g. on
+		 * reload).  Resync as for the first packet; dropping it as
+		 * stale would leave the PS waiting for an ACK forever.
+		 */
+		stream->n_restart++;
+		if (net_ratelimit())
+			netif_info(efx, drv, efx->net_dev,
+				   "counter stream restarted (got seq %u, expected %u); resyncing\n",
+				   seq_no, stream->next_seq);
+		stream->next_seq = seq_no + 1;
+		efx_tc_send_counter_ack(efx, stream, ack_type, true);
+		return;
+	}
+	if (gap < 0) {
+		/* Don't wind next_seq back, we'd count the gap twice */
+		stream->n_stale++;
+		return;
+	}
+	if (gap) {
+		stream->n_lost += gap;
+		if (net_ratelimit())
+			netif_warn(efx, drv, efx->net_dev,
+				   "lost %d counter packets (got seq %u, expected %u); counters inaccurate\n",
+				   gap, seq_no, stream->next_seq);
+	}
+	stream->next_seq = seq_no + 1;
+
+	if (++stream->unacked >= EFX_TC_CTR_CREDITS / 2)
+		efx_tc_send_counter_ack(efx, stream, ack_type, false);
 }
-#endif	
+
 static int efx_tc_start_channel(struct efx_channel *channel)
 {
 	struct efx_nic *efx = channel->efx;
@@ -1377,6 +1504,11 @@ static int efx_tc_start_channel(struct efx_channel *channel)
 			else
 				nic_data->rxfilter_counter = rc;
 		}
+		/* Packets may have been dropped while we were stopped, so
+		 * have the first one we see resynchronise the PS's credits.
+		 */
+		efx->tc->ctr_stream.synced = false;
+		efx->tc->ipsec_ctr_stream.synced = false;
 		/* Start counters will be called as part of switchdev mode set*/
 		//efx_mae_start_counters(efx, channel);
 		return 0;
@@ -1411,7 +1543,6 @@ static void efx_tc_stop_channel(struct efx_channel *channel)
                 printk("---%s----%d---\n",__func__,__LINE__);
 	#endif
                 if (channel->rx_queue.grant_credits)
-			//flush_workqueue(efx->cnt_queue);
                         flush_work(&channel->rx_queue.grant_work);
                 //printk("---%s----%d---\n",__func__,__LINE__);
                 if (nic_data->have_pf_mport)
@@ -1450,18 +1581,35 @@ static void efx_tc_get_channel_name(struct efx_channel *channel,
 	snprintf(buf, len, "%s-mae", channel->efx->name);
 }
 
-static void efx_tc_counter_work(struct work_struct *work)
+/* Read a counter's totals.  They are updated without locking by
+ * efx_tc_counter_update(), so go through the syncp for a consistent pair.
+ */
+static void efx_tc_counter_fetch(struct efx_tc_counter *cnt, u64 *packets,
+				 u64 *bytes)
+{
+	unsigned int start;
+
+	do {
+		start = u64_stats_fetch_begin(&cnt->syncp);
+		*packets = cnt->packets;
+		*bytes = cnt->bytes;
+	} while (u64_stats_fetch_retry(&cnt->syncp, start));
+}
+
+/* If any encap action using this counter has passed traffic since we last
+ * looked, indicate to the ARP cache that the neighbour is still active.
+ * Called with tc->mutex held, which keeps @cnt alive.
+ */
+static void efx_tc_counter_keepalive(struct efx_tc_counter *cnt)
 {
-	struct efx_tc_counter *cnt = container_of(work, struct efx_tc_counter, work);
 	struct efx_tc_encap_action *encap;
 	struct efx_tc_action_set *act;
 	unsigned long touched;
 	struct neighbour *n;
 
-	spin_lock_bh(&cnt->lock); /* Xlnx meld */
 	touched = READ_ONCE(cnt->touched);
 
-	//mutex_lock(&cnt->tc->mutex);
+	spin_lock_bh(&cnt->lock);
 	list_for_each_entry(act, &cnt->users, count_user) {
 		encap = act->encap_md;
 		if (!encap)
@@ -1471,9 +1619,6 @@ static void efx_tc_counter_work(struct work_struct *work)
 		if (time_after_eq(encap->neigh->used, touched))
 			continue;
 		encap->neigh->used = touched;
-		/* We have passed traffic using this ARP entry, so
-		 * indicate to the ARP cache that it's still active
-		 */
 		n = neigh_lookup(&arp_tbl, &encap->neigh->dst_ip,
 		/* XXX is this the right device? */
 				 encap->neigh->egdev);
@@ -1483,11 +1628,47 @@ static void efx_tc_counter_work(struct work_struct *work)
 		neigh_event_send(n, NULL);
 		neigh_release(n);
 	}
-	spin_unlock_bh(&cnt->lock); /* Xlnx meld*/
-	//mutex_unlock(&cnt->tc->mutex);
+	spin_unlock_bh(&cnt->lock);
+}
 
+/* Neighbour keep-alive for encap actions is batched into this periodic sweep
+ * rather than being driven from every counter update, so that a counter
+ * packet covering hundreds of counters doesn't generate hundreds of work
+ * items.  Neighbour reachable times are tens of seconds, so a one second
+ * period loses nothing.
+ */
+#define EFX_TC_NEIGH_SWEEP_INTERVAL	HZ
+
+static void efx_tc_neigh_sweep(struct work_struct *work)
+{
+	struct efx_tc_state *tc = container_of(to_delayed_work(work),
+					       struct efx_tc_state,
+					       neigh_sweep);
+	struct rhashtable_iter walk;
+	struct efx_tc_counter *cnt;
+
+	mutex_lock(&tc->mutex);
+	if (!tc->up)
+		goto out_unlock;
+	rhashtable_walk_enter(&tc->counter_ht, &walk);
+	rhashtable_walk_start(&walk);
+	while ((cnt = rhashtable_walk_next(&walk)) != NULL) {
+		if (IS_ERR(cnt))
+			continue;
+		if (list_empty(&cnt->users))
+			continue;
+		efx_tc_counter_keepalive(cnt);
+	}
+	rhashtable_walk_stop(&walk);
+	rhashtable_walk_exit(&walk);
+	schedule_delayed_work(&tc->neigh_sweep, EFX_TC_NEIGH_SWEEP_INTERVAL);
+out_unlock:
+	mutex_unlock(&tc->mutex);
 }
 
+/* Called only from the TC channel's NAPI poll, so there is a single writer
+ * and no lock is needed; readers use efx_tc_counter_fetch().
+ */
 static void efx_tc_counter_update(struct efx_nic *efx, u32 counter_idx,
 				  u64 packets, u64 bytes)
 {
@@ -1498,7 +1679,7 @@ static void efx_tc_counter_update(struct efx_nic *efx, u32 counter_idx,
 	 */
 	rcu_read_lock(); /* Protect against deletion of 'cnt' */
 	cnt = efx_tc_flower_find_counter_by_fw_id(efx, counter_idx);
-	if ((cnt == NULL) && net_ratelimit()) {
+	if (!cnt) {
 		/* This could theoretically happen due to a race where an
 		 * update from the counter is generated between allocating
 		 * it and adding it to the hashtable, in
@@ -1507,19 +1688,14 @@ static void efx_tc_counter_update(struct efx_nic *efx, u32 counter_idx,
 		 * any action, so should not have counted any packets; thus
 		 * the HW should not be sending updates (zero squash).
 		 */
-		/*netif_warn(efx, drv, efx->net_dev,
-			   "Got update for unwanted MAE counter %u\n",
-			   counter_idx);*/
 		goto out;
 	}
 
-	spin_lock_bh(&cnt->lock);
+	u64_stats_update_begin(&cnt->syncp);
 	cnt->packets += packets;
 	cnt->bytes += bytes;
-	cnt->touched = jiffies;
-	spin_unlock_bh(&cnt->lock);
-	queue_work(efx->cnt_queue, &cnt->work);
-//	schedule_work(&cnt->work);
+	u64_stats_update_end(&cnt->syncp);
+	WRITE_ONCE(cnt->touched, jiffies);
 out:
 	rcu_read_unlock();
 }
@@ -1649,7 +1825,6 @@ static bool efx_tc_rx(struct efx_channel *channel)
 						     channel->rx_pkt_index);
 	const u8 *data = efx_rx_buf_va(rx_buf);
 	struct efx_nic *efx = channel->efx;
-	uint16_t u25_seq_num = 0 , ipsec_seq_num;
 	const char *reason;
 	int rc = -EINVAL;
 	u8 version;
@@ -1684,7 +1859,9 @@ static bool efx_tc_rx(struct efx_channel *channel)
 
 		type = hdr->type;
 		if (type == EMCDI_HEADER_TYPE_IPSEC_COUNTER) {
-			ipsec_seq_num = ntohs(hdr->seq_num);
+			efx_tc_ctr_stream_rx(efx, &efx->tc->ipsec_ctr_stream,
+					     EFX_TC_CTR_UNPACED,
+					     ntohs(hdr->seq_num));
 			data = data + sizeof (struct emcdi_hdr);
 
 			spi = le32_to_cpu(*(__le32 *)(data+1));
@@ -1699,14 +1876,8 @@ static bool efx_tc_rx(struct efx_channel *channel)
 
 			packet_count = packet_count >> 24;
 			byte_count = byte_count >> 16;
-	//		append_ipsec_stats(spi, byte_count, packet_count);
-			if (efx_is_u25(efx)) {
-	//			rc = efx_tc_send_counter_ack_ipsec(efx, ipsec_seq_num);
-				if (rc)
-					netif_err(efx, drv, efx->net_dev,
-						"Failed to send counter ack packet, rc=%d.\n",
-						rc);
-			}
+			efx_ipsec_update_sa_stats(efx, spi, packet_count,
+						  byte_count);
 			goto out;
 		}
 
@@ -1715,7 +1886,9 @@ static bool efx_tc_rx(struct efx_channel *channel)
                         reason = "outer MCDI header type is not valid";
                         goto fail;
                 }
-		u25_seq_num = ntohs(hdr->seq_num);
+		efx_tc_ctr_stream_rx(efx, &efx->tc->ctr_stream,
+				     EMCDI_HEADER_TYPE_COUNTER_ACK,
+				     ntohs(hdr->seq_num));
 		data = data + sizeof(struct emcdi_hdr);
 	}
 
@@ -1736,15 +1909,6 @@ static bool efx_tc_rx(struct efx_channel *channel)
 				  version);
 		break;
 	}
-#if 0
-	if (efx_is_u25(efx)) {
-		rc = efx_tc_send_counter_ack(efx, u25_seq_num);
-		if (rc)
-			netif_err(efx, drv, efx->net_dev,
-                           	"Failed to send counter ack packet, rc=%d.\n",
-                           	 rc);
-	}
-#endif
 	goto out;
 fail:
 	if (net_ratelimit())
@@ -1792,6 +1956,7 @@ int efx_init_struct_tc(struct efx_nic *efx)
 	rc = rhashtable_init(&efx->tc->neigh_ht, &efx_neigh_ht_params);
 	if (rc < 0)
 		goto fail1;
+	INIT_DELAYED_WORK(&efx->tc->neigh_sweep, efx_tc_neigh_sweep);
 	rc = rhashtable_init(&efx->tc->counter_id_ht, &efx_tc_counter_id_ht_params);
 	if (rc < 0)
 		goto fail2;
@@ -1825,6 +1990,13 @@ int efx_init_struct_tc(struct efx_nic *efx)
         rc = rhashtable_init(&efx->tc->legacy_match_action_ht, &efx_legacy_match_action_ht_params);
         if (rc < 0)
                 goto fail11;
+	rc = rhashtable_init(&efx->tc->legacy_fw.match_ht,
+			     &efx_legacy_fw_match_ht_params);
+	if (rc < 0)
+		goto fail11a;
+	for (i = 0; i < EFX_LEGACY_FW_MAX_PORTS; i++)
+		INIT_LIST_HEAD(&efx->tc->legacy_fw.port[i].rules);
+	efx->tc->legacy_fw.capacity = EFX_LEGACY_FW_DEFAULT_CAPACITY;
 #endif
 	efx->tc->reps_filter_uc = -1;
 	efx->tc->reps_filter_mc = -1;
@@ -1845,6 +2017,8 @@ int efx_init_struct_tc(struct efx_nic *efx)
 	return 0;
 fail12:
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+	rhashtable_destroy(&efx->tc->legacy_fw.match_ht);
+fail11a:
         rhashtable_destroy(&efx->tc->legacy_match_action_ht);
 fail11:
 #endif
@@ -1888,7 +2062,8 @@ void efx_fini_struct_tc(struct efx_nic *efx)
 	mutex_lock(&efx->tc->mutex);
 	kfree(efx->tc->dflt_rules);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
-        rhashtable_free_and_destroy(&efx->tc->legacy_match_action_ht, efx_legacy_tc_free, efx);
+        efx_legacy_tc_free_all(efx);
+	rhashtable_destroy(&efx->tc->legacy_fw.match_ht);
 #endif
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_CONNTRACK_OFFLOAD)
 	rhashtable_free_and_destroy(&efx->tc->ct_ht, efx_tc_ct_free, efx);
@@ -4055,8 +4230,7 @@ static int efx_tc_action_stats(struct efx_nic *efx,
 	cnt = ctr->cnt;
 	spin_lock_bh(&cnt->lock);
 	/* Report only new pkts/bytes since last time TC asked */
-	packets = cnt->packets;
-	bytes = cnt->bytes;
+	efx_tc_counter_fetch(cnt, &packets, &bytes);
 	flow_stats_update(&tca->stats, bytes - cnt->old_bytes,
 			  packets - cnt->old_packets, cnt->touched,
 			  FLOW_ACTION_HW_STATS_DELAYED);
@@ -4128,8 +4302,7 @@ static int efx_tc_flower_stats(struct efx_nic *efx, struct net_device *net_dev,
 			cnt = act->count->cnt;
 			spin_lock_bh(&cnt->lock);
 			/* Report only new pkts/bytes since last time TC asked */
-			packets = cnt->packets;
-			bytes = cnt->bytes;
+			efx_tc_counter_fetch(cnt, &packets, &bytes);
 			a = tc->exts->actions[act->count_action_idx];
 			tcf_action_stats_update(a, bytes - cnt->old_bytes,
 						packets - cnt->old_packets,
@@ -4195,8 +4368,7 @@ static int efx_tc_flower_stats(struct efx_nic *efx, struct net_device *net_dev,
 
 	spin_lock_bh(&cnt->lock);
 	/* Report only new pkts/bytes since last time TC asked */
-	packets = cnt->packets;
-	bytes = cnt->bytes;
+	efx_tc_counter_fetch(cnt, &packets, &bytes);
 	flow_stats_update(&tc->stats, bytes - cnt->old_bytes,
 			  packets - cnt->old_packets,
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_FLOW_STATS_DROPS)
@@ -4856,8 +5028,7 @@ static void efx_tc_debugfs_dump_one_counter(struct seq_file *file,
 
 	/* get a consistent view */
 	spin_lock_bh(&cnt->lock);
-	packets = cnt->packets;
-	bytes = cnt->bytes;
+	efx_tc_counter_fetch(cnt, &packets, &bytes);
 	old_packets = cnt->old_packets;
 	old_bytes = cnt->old_bytes;
 	age = jiffies - cnt->touched;
@@ -4892,6 +5063,44 @@ static int efx_tc_debugfs_dump_mae_counters(struct seq_file *file, void *data)
 	return 0;
 }
 
+/* Binary equivalent of mae_counters for bulk collectors.  The debugfs file is
+ * single_open(), so the whole array is built at the first read() and later
+ * reads return the rest of the same snapshot.
+ */
+static int efx_tc_debugfs_dump_mae_counters_bin(struct seq_file *file,
+						void *data)
+{
+	struct efx_tc_counter_stats stats = {};
+	struct efx_tc_counter_index *ctr;
+	struct rhashtable_iter walk;
+	struct efx_nic *efx = data;
+	struct efx_tc_counter *cnt;
+	unsigned long age;
+
+	mutex_lock(&efx->tc->mutex);
+	if (!efx->tc->up)
+		goto out_unlock;
+	/* Holding tc->mutex keeps counter indices and their counters alive */
+	rhashtable_walk_enter(&efx->tc->counter_id_ht, &walk);
+	rhashtable_walk_start(&walk);
+	while ((ctr = rhashtable_walk_next(&walk)) != NULL) {
+		if (IS_ERR(ctr) || !ctr->cnt)
+			continue;
+		cnt = ctr->cnt;
+		stats.cookie = ctr->cookie;
+		stats.fw_id = cnt->fw_id;
+		efx_tc_counter_fetch(cnt, &stats.packets, &stats.bytes);
+		age = jiffies - READ_ONCE(cnt->touched);
+		stats.age_ms = jiffies_to_msecs(age);
+		seq_write(file, &stats, sizeof(stats));
+	}
+	rhashtable_walk_stop(&walk);
+	rhashtable_walk_exit(&walk);
+out_unlock:
+	mutex_unlock(&efx->tc->mutex);
+	return 0;
+}
+
 static void efx_tc_debugfs_dump_lhs_rule(struct seq_file *file,
 					 struct efx_tc_lhs_rule *rule)
 {
@@ -5137,11 +5346,35 @@ static int efx_tc_debugfs_dump_mae_neighs(struct seq_file *file, void *data)
 	return 0;
 }
 
+static void efx_tc_debugfs_dump_ctr_stream(struct seq_file *file,
+					   const char *name,
+					   struct efx_tc_ctr_stream *stream)
+{
+	seq_printf(file, "%s: packets %lu lost %lu stale %lu restart %lu ack_fail %lu next_seq %u%s\n",
+		   name, READ_ONCE(stream->n_packets),
+		   READ_ONCE(stream->n_lost), READ_ONCE(stream->n_stale),
+		   READ_ONCE(stream->n_restart),
+		   READ_ONCE(stream->n_ack_fail), READ_ONCE(stream->next_seq),
+		   READ_ONCE(stream->synced) ? "" : " (unsynced)");
+}
+
+static int efx_tc_debugfs_dump_ctr_streams(struct seq_file *file, void *data)
+{
+	struct efx_nic *efx = data;
+
+	efx_tc_debugfs_dump_ctr_stream(file, "mae", &efx->tc->ctr_stream);
+	efx_tc_debugfs_dump_ctr_stream(file, "ipsec",
+				       &efx->tc->ipsec_ctr_stream);
+	return 0;
+}
+
 static struct efx_debugfs_parameter efx_tc_debugfs[] = {
 	_EFX_RAW_PARAMETER(mae_rules, efx_tc_debugfs_dump_rules),
 	_EFX_RAW_PARAMETER(lhs_rules, efx_tc_debugfs_dump_lhs_rules),
 	_EFX_RAW_PARAMETER(mae_default_rules, efx_tc_debugfs_dump_default_rules),
 	_EFX_RAW_PARAMETER(mae_counters, efx_tc_debugfs_dump_mae_counters),
+	_EFX_RAW_PARAMETER(mae_counters_bin, efx_tc_debugfs_dump_mae_counters_bin),
+	_EFX_RAW_PARAMETER(counter_streams, efx_tc_debugfs_dump_ctr_streams),
 	_EFX_RAW_PARAMETER(mae_action_rule_caps, efx_tc_debugfs_dump_mae_ar_caps),
 	_EFX_RAW_PARAMETER(mae_outer_rule_caps, efx_tc_debugfs_dump_mae_or_caps),
 	_EFX_RAW_PARAMETER(mae_prios, efx_tc_debugfs_dump_action_prios),
@@ -5151,6 +5384,33 @@ static struct efx_debugfs_parameter efx_tc_debugfs[] = {
 #endif
 	{NULL}
 };
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+static int efx_tc_debugfs_dump_legacy_fw(struct seq_file *file, void *data)
+{
+	struct efx_nic *efx = data;
+	struct efx_legacy_fw_state *fw = &efx->tc->legacy_fw;
+	unsigned int i;
+
+	mutex_lock(&efx->tc->mutex);
+	seq_printf(file, "capacity %u rules %u hwm %u\n",
+		   fw->capacity, fw->n_rules, fw->hwm);
+	seq_printf(file, "refused full %lu duplicate %lu, overlapping %lu\n",
+		   fw->n_full, fw->n_duplicates, fw->n_overlaps);
+	for (i = 0; i < EFX_LEGACY_FW_MAX_PORTS; i++)
+		if (fw->port[i].hwm)
+			seq_printf(file, "port %u: rules %u hwm %u\n", i,
+				   fw->port[i].n_rules, fw->port[i].hwm);
+	mutex_unlock(&efx->tc->mutex);
+	return 0;
+}
+
+static struct efx_debugfs_parameter efx_legacy_tc_debugfs[] = {
+	_EFX_RAW_PARAMETER(legacy_fw_occupancy, efx_tc_debugfs_dump_legacy_fw),
+	_EFX_RAW_PARAMETER(counter_streams, efx_tc_debugfs_dump_ctr_streams),
+	{NULL}
+};
+#endif
 #endif /* CONFIG_SFC_DEBUGFS */
 
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_FLOW_INDR_DEV_REGISTER)
@@ -5363,6 +5623,7 @@ int efx_init_tc(struct efx_nic *efx)
 	efx_extend_debugfs_port(efx, efx, 0, efx_tc_debugfs);
 #endif
 	efx->tc->up = true;
+	schedule_delayed_work(&efx->tc->neigh_sweep, EFX_TC_NEIGH_SWEEP_INTERVAL);
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_FLOW_INDR_DEV_REGISTER)
 	rc = flow_indr_dev_register(efx_tc_indr_setup_cb, efx);
 #endif
@@ -5382,6 +5643,8 @@ void efx_fini_tc(struct efx_nic *efx)
 #ifdef CONFIG_SFC_DEBUGFS
 	efx_trim_debugfs_port(efx, efx_tc_debugfs);
 #endif
+	/* Takes tc->mutex itself */
+	cancel_delayed_work_sync(&efx->tc->neigh_sweep);
 	mutex_lock(&efx->tc->mutex);
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_FLOW_INDR_DEV_REGISTER)
 	if (efx->tc->up)
@@ -5469,6 +5732,100 @@ static int efx_legacy_flower_parse_match(struct efx_nic *efx,
 
 }
 
+/* Two legacy matches overlap if some packet could hit both, i.e. no field
+ * has bits that both rules care about but disagree on.
+ */
+static bool efx_legacy_match_overlaps(const struct efx_legacy_match *a,
+				      const struct efx_legacy_match *b)
+{
+#define DISJOINT(_f)	((a->value._f ^ b->value._f) & a->mask._f & b->mask._f)
+	unsigned int i;
+
+	/* n_proto goes to the CAM with its mask like the other fields, so
+	 * rules that both leave it wildcarded still overlap.
+	 */
+	if (DISJOINT(n_proto) ||
+	    DISJOINT(ingress_port) || DISJOINT(chain_index) ||
+	    DISJOINT(ip_proto) || DISJOINT(sport) || DISJOINT(dport) ||
+	    DISJOINT(src_ip) || DISJOINT(dst_ip))
+		return false;
+	for (i = 0; i < ARRAY_SIZE(a->value.src_ip6.s6_addr32); i++)
+		if (DISJOINT(src_ip6.s6_addr32[i]) ||
+		    DISJOINT(dst_ip6.s6_addr32[i]))
+			return false;
+#undef DISJOINT
+	return true;
+}
+
+/* Account for @rule in the legacy firewall CAM occupancy before asking the
+ * firmware to insert it.  Fails with -ENOSPC if the CAM is full, or -EEXIST
+ * if a rule with an identical match is already offloaded; rules that merely
+ * overlap an existing one are counted but allowed.
+ */
+static int efx_legacy_fw_reserve(struct efx_nic *efx,
+				 struct efx_legacy_flow_rule *rule,
+				 struct netlink_ext_ack *extack)
+{
+	struct efx_legacy_fw_state *fw = &efx->tc->legacy_fw;
+	struct efx_legacy_flow_rule *old;
+	struct efx_legacy_fw_port *port;
+	int rc = 0;
+
+	mutex_lock(&efx->tc->mutex);
+	if (fw->n_rules >= fw->capacity) {
+		fw->n_full++;
+		NL_SET_ERR_MSG_MOD(extack, "Firewall rule table is full");
+		rc = -ENOSPC;
+		goto out_unlock;
+	}
+	old = rhashtable_lookup_get_insert_fast(&fw->match_ht,
+						&rule->match_linkage,
+						efx_legacy_fw_match_ht_params);
+	if (old) {
+		if (IS_ERR(old)) {
+			rc = PTR_ERR(old);
+			goto out_unlock;
+		}
+		fw->n_duplicates++;
+		netif_dbg(efx, drv, efx->net_dev,
+			  "Firewall rule %lx has the same match as rule %lx\n",
+			  rule->cookie, old->cookie);
+		NL_SET_ERR_MSG_MOD(extack, "Identical firewall rule already offloaded");
+		rc = -EEXIST;
+		goto out_unlock;
+	}
+
+	port = &fw->port[rule->match.value.ingress_port % EFX_LEGACY_FW_MAX_PORTS];
+	list_for_each_entry(old, &port->rules, port_list)
+		if (efx_legacy_match_overlaps(&rule->match, &old->match)) {
+			fw->n_overlaps++;
+			netif_dbg(efx, drv, efx->net_dev,
+				  "Firewall rule %lx overlaps rule %lx\n",
+				  rule->cookie, old->cookie);
+			break;
+		}
+	list_add_tail(&rule->port_list, &port->rules);
+	port->hwm = max(port->hwm, ++port->n_rules);
+	fw->hwm = max(fw->hwm, ++fw->n_rules);
+out_unlock:
+	mutex_unlock(&efx->tc->mutex);
+	return rc;
+}
+
+static void efx_legacy_fw_release(struct efx_nic *efx,
+				  struct efx_legacy_flow_rule *rule)
+{
+	struct efx_legacy_fw_state *fw = &efx->tc->legacy_fw;
+
+	mutex_lock(&efx->tc->mutex);
+	rhashtable_remove_fast(&fw->match_ht, &rule->match_linkage,
+			       efx_legacy_fw_match_ht_params);
+	list_del(&rule->port_list);
+	fw->port[rule->match.value.ingress_port % EFX_LEGACY_FW_MAX_PORTS].n_rules--;
+	fw->n_rules--;
+	mutex_unlock(&efx->tc->mutex);
+}
+
 static int efx_configure_flower(struct efx_nic *efx,
                  struct net_device *net_dev,
                  struct flow_cls_offload *tc)
@@ -5488,12 +5845,10 @@ static int efx_configure_flower(struct efx_nic *efx,
     const struct flow_action_entry *fa;
     struct efx_legacy_match match;
     //u32 acts_id;
+    bool reserved = false;
     long rc;
     int i;
 
-    if (efx->flow_id > 1024) {
-            return -ENOMEM;
-    }
     /* Parse match */
     memset(&match, 0, sizeof(match));
 #if defined(EFX_USE_KCOMPAT) && !defined(EFX_HAVE_TC_FLOW_OFFLOAD)
@@ -5568,19 +5923,26 @@ static int efx_configure_flower(struct efx_nic *efx,
                 break;
         }
     }
-    rule->match = match;
+    /* memcpy rather than assignment so padding stays zeroed for match_ht */
+    memcpy(&rule->match, &match, sizeof(match));
+    rc = efx_legacy_fw_reserve(efx, rule, extack);
+    if (rc)
+            goto release;
+    reserved = true;
     rc = efx_legacy_insert_rule(efx, &match, act, EFX_FIREWALL_PRIO, act->fw_id, &rule->fw_id);
     if(rc) {
             rc = -EOPNOTSUPP;
             goto release;
     }
-    act->fw_id = efx->flow_id + 1;
+    /* n_rules is protected by the tc mutex, like the rest of legacy_fw */
+    mutex_lock(&efx->tc->mutex);
+    act->fw_id = efx->tc->legacy_fw.n_rules;
+    mutex_unlock(&efx->tc->mutex);
     act = NULL; /* end of the line */
 
 #if defined(EFX_USE_KCOMPAT) && !defined(EFX_HAVE_TC_FLOW_OFFLOAD)
     kfree(fr);
 #endif
-    efx->flow_id += 1;
     return 0;
 
 release:
@@ -5591,6 +5953,8 @@ release:
         efx_tc_free_action_set(efx, act, false);*/
     if (rule) {
         struct efx_legacy_action_set *act;
+        if (reserved)
+            efx_legacy_fw_release(efx, rule);
         rhashtable_remove_fast(&efx->tc->legacy_match_action_ht,
                        &rule->linkage,
                        efx_legacy_match_action_ht_params);
@@ -5647,15 +6011,243 @@ static int efx_delete_flower(struct efx_nic *efx,
         /* Remove it from HW */
         efx_legacy_delete_rule(efx, rule);
         /* Delete it from SW */
+        efx_legacy_fw_release(efx, rule);
         rhashtable_remove_fast(&efx->tc->legacy_match_action_ht, &rule->linkage,
                                efx_legacy_match_action_ht_params);
         netif_dbg(efx, drv, efx->net_dev, "Removed filter %lx\n", rule->cookie);
         kfree(rule);
 	rule = NULL;
-        efx->flow_id -= 1;
         return 0;
 }
 
+static void efx_legacy_free_rule(struct efx_legacy_flow_rule *rule)
+{
+	struct efx_legacy_action_set *act, *next;
+
+	list_for_each_entry_safe(act, next, &rule->acts.list, list)
+		kfree(act);
+	kfree(rule);
+}
+
+static struct efx_legacy_flow_rule *
+efx_legacy_ioctl_build_rule(struct efx_nic *efx,
+			    const struct efx_firewall_rule *req)
+{
+	struct efx_legacy_flow_rule *rule;
+	struct efx_legacy_action_set *act;
+	struct efx_legacy_match *match;
+
+	if (req->action != EFX_FIREWALL_RULE_ACTION_DROP &&
+	    req->action != EFX_FIREWALL_RULE_ACTION_ACCEPT)
+		return ERR_PTR(-EOPNOTSUPP);
+	if ((req->sport_mask || req->dport_mask) &&
+	    ((req->ip_proto != IPPROTO_UDP && req->ip_proto != IPPROTO_TCP) ||
+	     req->ip_proto_mask != 0xff))
+		return ERR_PTR(-EINVAL);
+
+	rule = kzalloc(sizeof(*rule), GFP_KERNEL);
+	act = kzalloc(sizeof(*act), GFP_KERNEL);
+	if (!rule || !act) {
+		kfree(rule);
+		kfree(act);
+		return ERR_PTR(-ENOMEM);
+	}
+	INIT_LIST_HEAD(&rule->acts.list);
+	rule->cookie = req->cookie;
+	act->action_flag = req->action;
+	list_add_tail(&act->list, &rule->acts.list);
+
+	/* Same defaults as efx_legacy_flower_parse_match() */
+	match = &rule->match;
+	match->value.ingress_port = efx->port_num;
+	match->mask.ingress_port = 0xf;
+	match->value.chain_index = efx->port_num;
+	match->mask.chain_index = 0xf;
+	match->value.n_proto = req->eth_proto;
+	match->value.ip_proto = req->ip_proto;
+	match->mask.ip_proto = req->ip_proto_mask;
+	if (req->eth_proto == htons(ETH_P_IP)) {
+		match->value.src_ip = req->src_ip;
+		match->mask.src_ip = req->src_ip_mask;
+		match->value.dst_ip = req->dst_ip;
+		match->mask.dst_ip = req->dst_ip_mask;
+	} else if (req->eth_proto == htons(ETH_P_IPV6)) {
+		memcpy(&match->value.src_ip6, req->src_ip6, sizeof(struct in6_addr));
+		memcpy(&match->mask.src_ip6, req->src_ip6_mask, sizeof(struct in6_addr));
+		memcpy(&match->value.dst_ip6, req->dst_ip6, sizeof(struct in6_addr));
+		memcpy(&match->mask.dst_ip6, req->dst_ip6_mask, sizeof(struct in6_addr));
+	}
+	match->value.sport = req->sport;
+	match->mask.sport = req->sport_mask;
+	match->value.dport = req->dport;
+	match->mask.dport = req->dport_mask;
+	return rule;
+}
+
+static void efx_legacy_ioctl_add(struct efx_nic *efx,
+				 struct efx_firewall_rule *reqs,
+				 unsigned int count,
+				 struct efx_legacy_flow_rule **rules,
+				 const struct efx_legacy_match **matches,
+				 struct efx_legacy_action_set **acts,
+				 unsigned int *idx, int *rcs)
+{
+	struct efx_legacy_flow_rule *rule, *old;
+	unsigned int i, n = 0;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		rule = efx_legacy_ioctl_build_rule(efx, &reqs[i]);
+		if (IS_ERR(rule)) {
+			reqs[i].rc = PTR_ERR(rule);
+			continue;
+		}
+		old = rhashtable_lookup_get_insert_fast(&efx->tc->legacy_match_action_ht,
+							&rule->linkage,
+							efx_legacy_match_action_ht_params);
+		if (old) {
+			reqs[i].rc = IS_ERR(old) ? PTR_ERR(old) : -EEXIST;
+			efx_legacy_free_rule(rule);
+			continue;
+		}
+		rc = efx_legacy_fw_reserve(efx, rule, NULL);
+		if (rc) {
+			reqs[i].rc = rc;
+			rhashtable_remove_fast(&efx->tc->legacy_match_action_ht,
+					       &rule->linkage,
+					       efx_legacy_match_action_ht_params);
+			efx_legacy_free_rule(rule);
+			continue;
+		}
+		rules[n] = rule;
+		matches[n] = &rule->match;
+		acts[n] = list_first_entry(&rule->acts.list,
+					   struct efx_legacy_action_set, list);
+		idx[n++] = i;
+	}
+	if (!n)
+		return;
+
+	rc = efx_legacy_insert_rule_batch(efx, matches, acts, n, rcs);
+	for (i = 0; i < n; i++) {
+		reqs[idx[i]].rc = rc ?: rcs[i];
+		if (reqs[idx[i]].rc) {
+			efx_legacy_fw_release(efx, rules[i]);
+			rhashtable_remove_fast(&efx->tc->legacy_match_action_ht,
+					       &rules[i]->linkage,
+					       efx_legacy_match_action_ht_params);
+			efx_legacy_free_rule(rules[i]);
+		}
+	}
+}
+
+static void efx_legacy_ioctl_del(struct efx_nic *efx,
+				 struct efx_firewall_rule *reqs,
+				 unsigned int count,
+				 struct efx_legacy_flow_rule **rules,
+				 const struct efx_legacy_match **matches,
+				 unsigned int *idx, int *rcs)
+{
+	struct efx_legacy_flow_rule *rule;
+	unsigned int i, n = 0;
+	unsigned long cookie;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		cookie = reqs[i].cookie;
+		rule = rhashtable_lookup_fast(&efx->tc->legacy_match_action_ht,
+					      &cookie,
+					      efx_legacy_match_action_ht_params);
+		if (!rule) {
+			reqs[i].rc = -ENOENT;
+			continue;
+		}
+		/* Unhash now so a cookie repeated in the batch is only
+		 * removed once.
+		 */
+		rhashtable_remove_fast(&efx->tc->legacy_match_action_ht,
+				       &rule->linkage,
+				       efx_legacy_match_action_ht_params);
+		rules[n] = rule;
+		matches[n] = &rule->match;
+		idx[n++] = i;
+	}
+	if (!n)
+		return;
+
+	rc = efx_legacy_delete_rule_batch(efx, matches, n, rcs);
+	for (i = 0; i < n; i++) {
+		/* As in efx_delete_flower(), the software state goes away
+		 * whether or not the hardware removal succeeded.
+		 */
+		reqs[idx[i]].rc = rc ?: rcs[i];
+		efx_legacy_fw_release(efx, rules[i]);
+		efx_legacy_free_rule(rules[i]);
+	}
+}
+
+/* Handle a FIREWALL_OPERATION ioctl: add or remove a burst of rules in as
+ * few eMCDI messages as possible.
+ * Context: process, rtnl_lock() held.
+ */
+int efx_legacy_firewall_ioctl(struct efx_nic *efx, struct ifreq *ifr)
+{
+	struct efx_firewall_rule_batch __user *ubatch = ifr->ifr_data;
+	const struct efx_legacy_match **matches = NULL;
+	struct efx_legacy_action_set **acts = NULL;
+	struct efx_legacy_flow_rule **rules = NULL;
+	struct efx_firewall_rule_batch batch;
+	struct efx_firewall_rule *reqs;
+	unsigned int *idx = NULL;
+	int *rcs = NULL;
+	size_t len;
+	int rc = 0;
+
+	if (!efx->tc || !efx->tc->up)
+		return -ENETDOWN;
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.op != EFX_FIREWALL_RULE_ADD && batch.op != EFX_FIREWALL_RULE_DEL)
+		return -EINVAL;
+	if (!batch.count)
+		return 0;
+	if (batch.count > EFX_FIREWALL_BATCH_MAX)
+		return -E2BIG;
+
+	len = array_size(batch.count, sizeof(*reqs));
+	reqs = memdup_user(ubatch->rules, len);
+	if (IS_ERR(reqs))
+		return PTR_ERR(reqs);
+
+	rules = kcalloc(batch.count, sizeof(*rules), GFP_KERNEL);
+	matches = kcalloc(batch.count, sizeof(*matches), GFP_KERNEL);
+	acts = kcalloc(batch.count, sizeof(*acts), GFP_KERNEL);
+	idx = kcalloc(batch.count, sizeof(*idx), GFP_KERNEL);
+	rcs = kcalloc(batch.count, sizeof(*rcs), GFP_KERNEL);
+	if (!rules || !matches || !acts || !idx || !rcs) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (batch.op == EFX_FIREWALL_RULE_ADD)
+		efx_legacy_ioctl_add(efx, reqs, batch.count, rules, matches,
+				     acts, idx, rcs);
+	else
+		efx_legacy_ioctl_del(efx, reqs, batch.count, rules, matches,
+				     idx, rcs);
+
+	if (copy_to_user(ubatch->rules, reqs, len))
+		rc = -EFAULT;
+out:
+	kfree(rcs);
+	kfree(idx);
+	kfree(acts);
+	kfree(matches);
+	kfree(rules);
+	kfree(reqs);
+	return rc;
+}
+
 static int efx_setup_legacy_cls_flower(struct efx_nic *efx,
                      struct flow_cls_offload *cls_flower)
 {
@@ -5686,11 +6278,22 @@ static int efx_setup_legacy_block_cb(enum tc_setup_type type, void *type_data,
 /*** Initilize TC in Legacy Mode ***/
 int efx_init_legacy_tc(struct efx_nic *efx)
 {
+    u32 max_rules;
     int rc = 0;
+
+    rc = efx_legacy_firewall_caps(efx, &max_rules);
+    if (rc)
+        return rc;
     mutex_lock(&efx->tc->mutex);
+    efx->tc->legacy_fw.capacity = max_rules ?: EFX_LEGACY_FW_DEFAULT_CAPACITY;
+    netif_dbg(efx, drv, efx->net_dev, "Firewall capacity %u rules%s\n",
+              efx->tc->legacy_fw.capacity, max_rules ? "" : " (default)");
+#ifdef CONFIG_SFC_DEBUGFS
+    if (!efx->tc->up)
+        efx_extend_debugfs_port(efx, efx, 0, efx_legacy_tc_debugfs);
+#endif
     efx->tc->up = true;
     mutex_unlock(&efx->tc->mutex);
-    rc = efx_legacy_firewall_caps(efx);
     return rc;
 }
 
@@ -5701,6 +6304,10 @@ void efx_fini_legacy_tc(struct efx_nic *efx)
     if (!efx->tc)
         return;
     mutex_lock(&efx->tc->mutex);
+#ifdef CONFIG_SFC_DEBUGFS
+    if (efx->tc->up)
+        efx_trim_debugfs_port(efx, efx_legacy_tc_debugfs);
+#endif
     efx->tc->up = false;
     mutex_unlock(&efx->tc->mutex);
 }
@@ -14,6 +14,7 @@
 
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_TC_OFFLOAD)
 #include <linux/mutex.h>
+#include <linux/u64_stats_sync.h>
 #include <net/pkt_cls.h>
 #include <net/tc_act/tc_tunnel_key.h>
 #include <net/tc_act/tc_pedit.h>
@@ -30,14 +31,17 @@
 struct efx_tc_counter {
 	u32 fw_id; /* index in firmware counter table */
 	struct rhash_head linkage; /* efx->tc->counter_ht */
-	spinlock_t lock; /* Serialises updates to counter values */
+	spinlock_t lock; /* Serialises readers' updates of old_* and users */
 	u32 gen; /* Generation count at which this counter is current */
+	/* packets, bytes and touched are written only by
+	 * efx_tc_counter_update(), from the TC channel's NAPI poll, without
+	 * taking @lock; read the totals with efx_tc_counter_fetch().
+	 */
+	struct u64_stats_sync syncp;
 	u64 packets, bytes;
 	u64 old_packets, old_bytes; /* Values last time passed to userspace */
 	/* jiffies of the last time we saw packets increase */
 	unsigned long touched;
-	struct work_struct work; /* For notifying encap actions */
-	struct efx_tc_state *tc; /* Allows workitem to access tc->mutex */
 	/* owners of corresponding count actions */
 	struct list_head users;
 };
@@ -123,10 +127,55 @@ struct efx_legacy_action_set_list {
 struct efx_legacy_flow_rule {
     unsigned long cookie;
     struct rhash_head linkage;
+    struct rhash_head match_linkage; /* entry in legacy_fw.match_ht */
+    struct list_head port_list; /* entry on legacy_fw.port[].rules */
     struct efx_legacy_match match;
     struct efx_legacy_action_set_list acts;
     u32 fw_id;
 };
+
+/* Used if the firmware does not report the CAM size in MC_CMD_FIREWALL_CAPS */
+#define EFX_LEGACY_FW_DEFAULT_CAPACITY	1024
+/* Ingress port and chain index are both 4-bit fields in the CAM key */
+#define EFX_LEGACY_FW_MAX_PORTS		16
+
+/**
+ * struct efx_legacy_fw_port - legacy firewall occupancy of one ingress port
+ * @rules: offloaded rules matching this ingress port, for overlap checks
+ * @n_rules: number of entries on @rules
+ * @hwm: high-water mark of @n_rules
+ */
+struct efx_legacy_fw_port {
+    struct list_head rules;
+    unsigned int n_rules;
+    unsigned int hwm;
+};
+
+/**
+ * struct efx_legacy_fw_state - driver view of the legacy firewall CAM
+ * @match_ht: offloaded rules keyed by &struct efx_legacy_match, so that
+ *	duplicates are refused without a round trip to the firmware
+ * @port: per ingress port occupancy; the chain index always equals the
+ *	ingress port in legacy mode so it is not tracked separately
+ * @capacity: number of rules the CAM can hold, from MC_CMD_FIREWALL_CAPS
+ * @n_rules: number of rules currently offloaded
+ * @hwm: high-water mark of @n_rules
+ * @n_full: insertions refused because the CAM was full
+ * @n_duplicates: insertions refused because an identical match exists
+ * @n_overlaps: insertions accepted that overlap an existing rule's match
+ *
+ * Protected by &efx_tc_state.mutex.
+ */
+struct efx_legacy_fw_state {
+    struct rhashtable match_ht;
+    struct efx_legacy_fw_port port[EFX_LEGACY_FW_MAX_PORTS];
+    unsigned int capacity;
+    unsigned int n_rules;
+    unsigned int hwm;
+    unsigned long n_full;
+    unsigned long n_duplicates;
+    unsigned long n_overlaps;
+};
 #endif
 
 struct efx_tc_action_set {
@@ -286,6 +335,36 @@ struct efx_tc_ct_entry {
 };
 #endif
 
+/* Counter packets the PS may send beyond the last one we acknowledged */
+#define EFX_TC_CTR_CREDITS	32
+
+/**
+ * struct efx_tc_ctr_stream - receive side of a U25 counter packet stream
+ * @next_seq: Sequence number expected in the next counter packet
+ * @synced: Whether @next_seq is valid; clear until the first packet arrives,
+ *	which is answered with a resync ACK
+ * @unacked: Packets received since the last ACK was sent
+ * @n_packets: Counter packets received
+ * @n_lost: Counter packets missing from the sequence.  The counts they
+ *	carried are lost, so the affected counters are inaccurate
+ * @n_stale: Duplicated or reordered counter packets
+ * @n_restart: Times the sequence jumped back further than the PS could
+ *	have reordered, i.e. the PS restarted its stream and was resynced
+ * @n_ack_fail: ACKs we failed to send
+ *
+ * Only used from the TC channel's NAPI poll, so needs no locking.
+ */
+struct efx_tc_ctr_stream {
+	u16 next_seq;
+	bool synced;
+	unsigned int unacked;
+	unsigned long n_packets;
+	unsigned long n_lost;
+	unsigned long n_stale;
+	unsigned long n_restart;
+	unsigned long n_ack_fail;
+};
+
 enum efx_tc_rule_prios {
 	EFX_TC_PRIO_TC, /* Rule inserted by TC */
 	EFX_TC_PRIO_DFLT, /* Default switch rule; one of efx_tc_default_rules */
@@ -308,6 +387,12 @@ enum efx_tc_rule_prios {
  * @ct_zone_ht: Hashtable of TC conntrack flowtable bindings
  * @ct_ht: Hashtable of TC conntrack flow entries
  * @neigh_ht: Hashtable of neighbour watches (&struct efx_neigh_binder)
+ * @neigh_sweep: Periodic work refreshing neighbours used by encap actions
+ *	whose counters have moved
+ * @ctr_stream: State of the U25 MAE counter packet stream from the PS
+ * @ipsec_ctr_stream: State of the U25 IPsec SA counter packet stream
+ * @legacy_match_action_ht: Hashtable of legacy firewall rules, by cookie
+ * @legacy_fw: Legacy firewall capacity and occupancy tracking
  * @reps_mport_id: MAE port allocated for representor RX
  * @reps_filter_uc: VNIC filter for representor unicast RX (promisc)
  * @reps_filter_mc: VNIC filter for representor multicast RX (allmulti)
@@ -330,6 +415,7 @@ struct efx_tc_state {
 	struct rhashtable match_action_ht;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
 	struct rhashtable legacy_match_action_ht;
+	struct efx_legacy_fw_state legacy_fw;
 #endif
 	struct rhashtable lhs_rule_ht;
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_CONNTRACK_OFFLOAD)
@@ -337,6 +423,9 @@ struct efx_tc_state {
 	struct rhashtable ct_ht;
 #endif
 	struct rhashtable neigh_ht;
+	struct delayed_work neigh_sweep;
+	struct efx_tc_ctr_stream ctr_stream;
+	struct efx_tc_ctr_stream ipsec_ctr_stream;
 	u32 reps_mport_id;
 	u32 reps_filter_uc, reps_filter_mc;
 	u16 reps_mport_vport_id;
@@ -355,6 +444,9 @@ int efx_tc_setup_block(struct net_device *net_dev, struct efx_nic *efx,
 		       struct flow_block_offload *tcb, struct efx_vfrep *efv);
 int efx_setup_tc(struct net_device *net_dev, enum tc_setup_type type,
 		 void *type_data);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+int efx_legacy_firewall_ioctl(struct efx_nic *efx, struct ifreq *ifr);
+#endif
 
 #else /* EFX_TC_OFFLOAD */
 
@@ -171,6 +171,12 @@ static int efx_tso_check_protocol(struct sk_buff *skb, __be16 *protocol)
 		struct vlan_ethhdr *veh = (struct vlan_ethhdr *)skb->data;
 
 		*protocol = veh->h_vlan_encapsulated_proto;
+		/* U25 representor packets carry a second (mport) tag */
+		if (*protocol == htons(ETH_P_8021Q)) {
+			struct vlan_hdr *vh = (struct vlan_hdr *)(veh + 1);
+
+			*protocol = vh->h_vlan_encapsulated_proto;
+		}
 	}
 #endif
 
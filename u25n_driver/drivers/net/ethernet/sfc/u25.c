@@ -48,13 +48,21 @@ int efx_u25_rx_get_mports(struct efx_rx_buffer *rx_buf,
 	return 0;
 }
 
+/* Drop the two mport VLAN tags by moving the MAC addresses, and the RX
+ * prefix the hash and timestamp are read from, forward over them.  The
+ * payload is not touched, so its checksum state remains valid and the
+ * buffer can still be handed to GRO as page fragments.  The caller must
+ * re-read the buffer's virtual address afterwards.
+ */
 static void efx_u25_remove_vlans_from_network(struct efx_nic *efx, 
 		struct efx_rx_buffer *rx_buf)
 {
 	u8 *eh = efx_rx_buf_va(rx_buf);
 
-	memcpy(eh + (2 * ETH_ALEN), eh + (2 * ETH_ALEN) + (2 * VLAN_HLEN),
-			rx_buf->len - (2 * VLAN_HLEN));
+	memmove(eh - efx->rx_prefix_size + (2 * VLAN_HLEN),
+		eh - efx->rx_prefix_size,
+		(2 * ETH_ALEN) + efx->rx_prefix_size);
+	rx_buf->page_offset += (2 * VLAN_HLEN);
 	rx_buf->len -= (2 * VLAN_HLEN);
 }
 
@@ -70,9 +78,8 @@ int efx_u25_rx_packet(struct efx_channel *channel, bool *is_from_network)
 
 	if (!nic_data->have_pf_mport) {
 		reason = "pf mport is not allocated";
-		if (net_ratelimit())
-			netif_err(efx, drv, efx->net_dev, "Unexpected packet (%s rc %d)\n",
-				reason, rc);
+		netif_dbg(efx, rx_err, efx->net_dev, "Unexpected packet (%s rc %d)\n",
+			  reason, rc);
 		return rc;
 	}
 
@@ -97,27 +104,32 @@ int efx_u25_rx_packet(struct efx_channel *channel, bool *is_from_network)
 			*is_from_network = false;
 			return 0;
 		} else {
-			struct net_device *rep_dev = efx_u25_find_vfrep_by_mport(efx,
-					inner_mport);
-			if (rep_dev && rep_dev->flags & IFF_UP) {
-				efx_u25_vfrep_rx_packet(netdev_priv(rep_dev),
-						rx_buf);
-				return 0;
-			} else {
-				rc =-EINVAL;
-				reason = "Representor netdev not found/not UP";
-				if (net_ratelimit())
-					netif_err(efx, drv, efx->net_dev, "Unexpected packet (%s rc %d)\n",
-						reason, rc);
+			struct efx_vfrep *efv;
+
+			rcu_read_lock();
+			efv = efx_u25_find_vfrep_by_mport(efx, inner_mport);
+			if (unlikely(!efv)) {
+				rcu_read_unlock();
+				/* Counted in the channel's rx_mport_bad */
+				rc = -ENOENT;
+				reason = "no representor for mport";
+				netif_dbg(efx, rx_err, efx->net_dev,
+					  "Unexpected packet (%s %#x rc %d)\n",
+					  reason, inner_mport, rc);
 				return rc;
 			}
+			if (efv->net_dev->flags & IFF_UP)
+				efx_u25_vfrep_rx_packet(efv, channel, rx_buf);
+			else
+				atomic_inc(&efv->stats.rx_dropped);
+			rcu_read_unlock();
+			return 0;
 		}
 	} else {
 		rc = -EINVAL;
 		reason = "invalid PF mport";
-		if (net_ratelimit())
-			netif_err(efx, drv, efx->net_dev, "Unexpected packet (%s rc %d)\n",
-				reason, rc);
+		netif_dbg(efx, rx_err, efx->net_dev, "Unexpected packet (%s rc %d)\n",
+			  reason, rc);
 		return rc;
 	}
 }
@@ -157,6 +169,11 @@ int efx_u25_probe(struct efx_nic *efx)
 	spin_lock_init(&nic_data->vf_reps_lock);
 	INIT_LIST_HEAD(&nic_data->udp_tunnel_list);
 
+	nic_data->vfrep_by_mport = vzalloc(U25_MPORT_LABELS *
+					   sizeof(*nic_data->vfrep_by_mport));
+	if (!nic_data->vfrep_by_mport)
+		return -ENOMEM;
+
 	efx_u25_get_base_mport(efx);
 
 	//TODO - send normal MCDI to enable encapsulated MCDI via MDIO
@@ -164,19 +181,27 @@ int efx_u25_probe(struct efx_nic *efx)
 
 	rc = efx_ipsec_init(efx);
 	if (rc)
-		return rc;
+		goto fail;
 
 	return 0;
+fail:
+	vfree(nic_data->vfrep_by_mport);
+	nic_data->vfrep_by_mport = NULL;
+	return rc;
 }
 
 void efx_u25_remove(struct efx_nic *efx)
 {
+	struct efx_ef10_nic_data *nic_data = efx->nic_data;
+
 	if (efx->type->is_vf) {
 		// TODO -
 		return;
 	}
 
 	efx_ipsec_fini(efx);
+	vfree(nic_data->vfrep_by_mport);
+	nic_data->vfrep_by_mport = NULL;
 
 	//TODO -
 }
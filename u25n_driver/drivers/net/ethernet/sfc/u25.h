@@ -13,6 +13,9 @@
 #define U25_MPORT_TO_VLAN(mport)	(mport ^ 0x800)
 #define U25_VLAN_TO_MPORT(vlan)		(vlan ^ 0x800)
 
+/* m-port labels are 12 bits, as carried in the VLAN tags */
+#define U25_MPORT_LABELS		0x1000
+
 #define U25_MPORT_ID_COUNTER		0xFD
 #define U25_MPORT_ID_CONTROL		0xFE
 
@@ -8,9 +8,14 @@
  */
 
 #include "u25_rep.h"
+#include "efx.h"
 #include "mae.h"
 #include "rx_common.h"
 #include "ef10_sriov.h"
+#include "xdp.h"
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_TRACE)
+#include <trace/events/xdp.h>
+#endif
 
 //#include "filter.h"
 
@@ -19,6 +24,19 @@
 #define EFX_U25_VFREP_DRIVER	"efx_u25_vfrep"
 #define EFX_U25_VFREP_VERSION	"0.0.1"
 
+/* Size of headers copied into a representor skb's linear data area */
+#define EFX_U25_VFREP_RX_CB_LEN	192u
+
+/* Bytes of mport VLAN tags added to each representor TX packet */
+#define EFX_U25_VFREP_TX_TAGS_LEN	(2 * VLAN_HLEN)
+
+/* XDP transmit from a representor pushes the mport tags into the headroom
+ * of an xdp_frame, as the PF's XDP TX queues have no VLAN option descriptors.
+ */
+#if !defined(EFX_USE_KCOMPAT) || (defined(EFX_HAVE_XDP_TX) && defined(EFX_HAVE_XDP_FRAME_API))
+#define EFX_U25_VFREP_XDP_TX
+#endif
+
 void pkt_hex_dump(uint8_t *data, char *func)
 {
     size_t len;
@@ -49,18 +67,37 @@ void pkt_hex_dump(uint8_t *data, char *func)
 
 static int efx_u25_vfrep_poll(struct napi_struct *napi, int weight);
 
+/* Representor queues map one-to-one onto the PF's combined channels; the
+ * slow-path filter spreads representor traffic across them with RSS.
+ */
+static unsigned int efx_u25_vfrep_n_queues(struct efx_nic *efx)
+{
+	return max(efx->n_combined_channels, 1u);
+}
+
 static int efx_u25_vfrep_init_struct(struct efx_nic *efx,
 				       struct efx_vfrep *efv, unsigned int i)
 {
+	unsigned int q;
+
 	efv->parent = efx;
 	BUILD_BUG_ON(MAE_MPORT_SELECTOR_NULL);
 	efv->vf_idx = i;
+	efv->n_rxq = efx_u25_vfrep_n_queues(efx);
+	efv->rxq = kcalloc(efv->n_rxq, sizeof(*efv->rxq), GFP_KERNEL);
+	if (!efv->rxq)
+		return -ENOMEM;
+	for (q = 0; q < efv->n_rxq; q++) {
+		struct efx_vfrep_rxq *rxq = &efv->rxq[q];
+
+		rxq->efv = efv;
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
-	INIT_LIST_HEAD(&efv->rx_list);
+		INIT_LIST_HEAD(&rxq->rx_list);
 #else
-	__skb_queue_head_init(&efv->rx_list);
+		__skb_queue_head_init(&rxq->rx_list);
 #endif
-	spin_lock_init(&efv->rx_lock);
+		spin_lock_init(&rxq->rx_lock);
+	}
 	efv->msg_enable = NETIF_MSG_DRV | NETIF_MSG_PROBE |
 			  NETIF_MSG_LINK | NETIF_MSG_IFDOWN |
 			  NETIF_MSG_IFUP | NETIF_MSG_RX_ERR |
@@ -68,21 +105,51 @@ static int efx_u25_vfrep_init_struct(struct efx_nic *efx,
 	return 0;
 }
 
+static void efx_u25_vfrep_fini_rxq(struct efx_vfrep_rxq *rxq)
+{
+	napi_disable(&rxq->napi);
+	netif_napi_del(&rxq->napi);
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_RXQ_INFO)
+	xdp_rxq_info_unreg(&rxq->xdp_rxq_info);
+#endif
+}
+
 static int efx_u25_vfrep_open(struct net_device *net_dev)
 {
 	struct efx_vfrep *efv = netdev_priv(net_dev);
+	unsigned int q;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_RXQ_INFO)
+	int rc;
+#endif
 
-	netif_napi_add(net_dev, &efv->napi, efx_u25_vfrep_poll, NAPI_POLL_WEIGHT);
-	napi_enable(&efv->napi);
+	for (q = 0; q < efv->n_rxq; q++) {
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_RXQ_INFO)
+		/* Seen by the representor's XDP program as its RX queue */
+		rc = xdp_rxq_info_reg(&efv->rxq[q].xdp_rxq_info, net_dev, q);
+		if (rc)
+			goto fail;
+#endif
+		netif_napi_add(net_dev, &efv->rxq[q].napi, efx_u25_vfrep_poll,
+			       NAPI_POLL_WEIGHT);
+		napi_enable(&efv->rxq[q].napi);
+	}
 	return 0;
+
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_RXQ_INFO)
+fail:
+	while (q--)
+		efx_u25_vfrep_fini_rxq(&efv->rxq[q]);
+	return rc;
+#endif
 }
 
 static int efx_u25_vfrep_close(struct net_device *net_dev)
 {
 	struct efx_vfrep *efv = netdev_priv(net_dev);
+	unsigned int q;
 
-	napi_disable(&efv->napi);
-	netif_napi_del(&efv->napi);
+	for (q = 0; q < efv->n_rxq; q++)
+		efx_u25_vfrep_fini_rxq(&efv->rxq[q]);
 	return 0;
 }
 
@@ -93,6 +160,8 @@ netdev_tx_t __u25_hard_start_xmit(struct sk_buff *skb,
         struct efx_nic *efx = efx_netdev_priv(net_dev);
         struct efx_tx_queue *tx_queue;
         struct efx_channel *channel;
+        struct netdev_queue *txq;
+        unsigned int index;
         int rc;
         //static int i = 0;
 
@@ -106,7 +175,14 @@ netdev_tx_t __u25_hard_start_xmit(struct sk_buff *skb,
                 i = 0;
         channel = efx->channel[efv->channel];
 #endif
-	channel = efx_get_tx_channel(efx, skb_get_queue_mapping(skb));
+	/* The representor's TX queues map onto the PF's combined channels,
+	 * which may have been changed since the representor was created.
+	 */
+	index = skb_get_queue_mapping(skb);
+	if (index >= efx->n_combined_channels)
+		index = efx->n_combined_channels ?
+			index % efx->n_combined_channels : 0;
+	channel = efx_get_tx_channel(efx, index);
 	//pr_info("----channel:%d----skb_get_queue_mapping--%d\n", channel->channel, skb_get_queue_mapping(skb));
         netif_vdbg(efx, tx_queued, efx->net_dev,
                         "%s len %d data %d channel %d\n", __FUNCTION__,
@@ -116,8 +192,15 @@ netdev_tx_t __u25_hard_start_xmit(struct sk_buff *skb,
                 netif_stop_queue(net_dev);
                 goto err;
         }
+        /* Only the PF TX queue we are using needs locking, as it would
+         * be by the core for the PF's own transmits.  Queue selection may
+         * write option descriptors, so it is done under the lock too.
+         */
+        txq = channel->tx_queues[0].core_txq;
+        __netif_tx_lock(txq, smp_processor_id());
         tx_queue = efx->select_tx_queue(channel, skb);
         rc = __efx_enqueue_skb(tx_queue, skb);
+        __netif_tx_unlock(txq);
         if (rc == 0)
                 return NETDEV_TX_OK;
 
@@ -134,30 +217,38 @@ static netdev_tx_t efx_u25_vfrep_xmit(struct sk_buff *skb,
         struct efx_ef10_nic_data *nic_data = efx->nic_data;
         uint16_t pf_vlan_id = U25_MPORT_TO_VLAN(nic_data->pf_mport);
         uint16_t vf_vlan_id = U25_MPORT_TO_VLAN(efv->vf_mport);
-        netdev_tx_t rc;
+
+        /* The hardware inserts the mport tags, see
+         * efx_ef10_set_tx_queue_mport().
+         */
+        if (efv->tx_mport_tags)
+                goto xmit;
 
         /* These packets are slowpath packets directed to VFs,
          * Append inner VLAN of VF and Outer VLAN of PF */
-        skb_put_padto(skb, 60);
-        __skb_push(skb, offset);
-        __vlan_insert_tag(skb, htons(ETH_P_8021Q), vf_vlan_id);
-        __skb_pull(skb, offset);
-
+        if (skb_put_padto(skb, 60)) {
+                atomic_inc(&efv->stats.tx_errors);
+                return NETDEV_TX_OK;
+        }
+        /* This unshares a cloned head, as TCP's are under TSO */
         __skb_push(skb, offset);
-        __vlan_insert_tag(skb, htons(ETH_P_8021Q), pf_vlan_id);
+        if (__vlan_insert_tag(skb, htons(ETH_P_8021Q), vf_vlan_id) ||
+            __vlan_insert_tag(skb, htons(ETH_P_8021Q), pf_vlan_id)) {
+                dev_kfree_skb_any(skb);
+                atomic_inc(&efv->stats.tx_errors);
+                return NETDEV_TX_OK;
+        }
         __skb_pull(skb, offset);
         skb->protocol = htons(ETH_P_8021Q);
 
+xmit:
         /* __u25_hard_start_xmit() will always return success even in the
          * case of TX drops, where it will increment efx's tx_dropped.  The
          * efv stats really only count attempted TX, not success/failure.
          */
         atomic_inc(&efv->stats.tx_packets);
         atomic_add(skb->len, &efv->stats.tx_bytes);
-        netif_tx_lock(efx->net_dev);
-        rc = __u25_hard_start_xmit(skb, efx->net_dev, efv);
-        netif_tx_unlock(efx->net_dev);
-        return rc;
+        return __u25_hard_start_xmit(skb, efx->net_dev, efv);
 }
 #if 0
 static netdev_tx_t __u25_hard_start_xmit(struct sk_buff *skb,
@@ -279,6 +370,116 @@ static void efx_u25_vfrep_get_stats64(struct net_device *dev,
 	stats->tx_errors = atomic_read(&efv->stats.tx_errors);
 }
 
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP)
+/* The representor's frames sit behind 8 bytes of mport tags in PF pages */
+static unsigned int efx_u25_vfrep_xdp_max_mtu(struct efx_vfrep *efv)
+{
+	return efx_xdp_max_mtu(efv->parent) - EFX_U25_VFREP_TX_TAGS_LEN;
+}
+
+static int efx_u25_vfrep_xdp_setup_prog(struct efx_vfrep *efv,
+					struct bpf_prog *prog)
+{
+	struct bpf_prog *old_prog;
+
+	if (prog && efv->net_dev->mtu > efx_u25_vfrep_xdp_max_mtu(efv)) {
+		netif_err(efv, drv, efv->net_dev,
+			  "Unable to configure XDP with MTU of %d (max: %d)\n",
+			  efv->net_dev->mtu, efx_u25_vfrep_xdp_max_mtu(efv));
+		return -EINVAL;
+	}
+
+	old_prog = rtnl_dereference(efv->xdp_prog);
+	rcu_assign_pointer(efv->xdp_prog, prog);
+	/* Release the reference that was originally passed by the caller. */
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	return 0;
+}
+
+static int efx_u25_vfrep_xdp(struct net_device *net_dev,
+			     struct netdev_bpf *xdp)
+{
+	struct efx_vfrep *efv = netdev_priv(net_dev);
+#if defined(EFX_USE_KCOMPAT) && defined(EFX_HAVE_XDP_QUERY_PROG)
+	struct bpf_prog *xdp_prog;
+#endif
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return efx_u25_vfrep_xdp_setup_prog(efv, xdp->prog);
+#if defined(EFX_USE_KCOMPAT) && defined(EFX_HAVE_XDP_QUERY_PROG)
+	case XDP_QUERY_PROG:
+		xdp_prog = rtnl_dereference(efv->xdp_prog);
+#if defined(EFX_USE_KCOMPAT) && (defined(EFX_HAVE_XDP_PROG_ATTACHED) || defined(EFX_HAVE_XDP_OLD))
+		xdp->prog_attached = !!xdp_prog;
+#endif
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_PROG_ID) || !defined(EFX_HAVE_XDP_OLD)
+		xdp->prog_id = xdp_prog ? xdp_prog->aux->id : 0;
+#endif
+		return 0;
+#endif
+	default:
+		return -EINVAL;
+	}
+}
+#endif
+
+#ifdef EFX_U25_VFREP_XDP_TX
+/* Push the PF (outer) and VF (inner) mport tags into @xdpf's headroom, giving
+ * the same frame efx_u25_vfrep_xmit() builds for an skb.
+ */
+static int efx_u25_vfrep_xdp_push_tags(struct efx_vfrep *efv,
+				       struct xdp_frame *xdpf)
+{
+	struct efx_ef10_nic_data *nic_data = efv->parent->nic_data;
+	__be16 *tags;
+	u8 *data;
+
+	if (xdpf->headroom < EFX_U25_VFREP_TX_TAGS_LEN || xdpf->len < ETH_HLEN)
+		return -ENOSPC;
+
+	data = (u8 *)xdpf->data - EFX_U25_VFREP_TX_TAGS_LEN;
+	memmove(data, xdpf->data, 2 * ETH_ALEN);
+	tags = (__be16 *)(data + 2 * ETH_ALEN);
+	tags[0] = htons(ETH_P_8021Q);
+	tags[1] = htons(U25_MPORT_TO_VLAN(nic_data->pf_mport));
+	tags[2] = htons(ETH_P_8021Q);
+	tags[3] = htons(U25_MPORT_TO_VLAN(efv->vf_mport));
+
+	xdpf->data = data;
+	xdpf->len += EFX_U25_VFREP_TX_TAGS_LEN;
+	xdpf->headroom -= EFX_U25_VFREP_TX_TAGS_LEN;
+	return 0;
+}
+
+#if !defined(EFX_USE_KCOMPAT) || (defined(EFX_HAVE_XDP_REDIR) && defined(EFX_HAVE_XDP_TX_FLAGS))
+/* Context: NAPI.  Target of XDP_REDIRECT into a representor; the frames go
+ * to the VF through the PF's XDP TX queues.
+ */
+static int efx_u25_vfrep_xdp_xmit(struct net_device *net_dev, int n,
+				  struct xdp_frame **xdpfs, u32 flags)
+{
+	struct efx_vfrep *efv = netdev_priv(net_dev);
+	int i, rc;
+
+	if (!netif_running(net_dev))
+		return -EINVAL;
+
+	/* Frames from the first one we can't tag on are left to the caller */
+	for (i = 0; i < n; i++)
+		if (efx_u25_vfrep_xdp_push_tags(efv, xdpfs[i]))
+			break;
+
+	rc = efx_xdp_tx_buffers(efv->parent, i, xdpfs, flags & XDP_XMIT_FLUSH);
+	if (rc > 0)
+		atomic_add(rc, &efv->stats.tx_packets);
+	return rc;
+}
+#endif
+#endif
+
 const struct net_device_ops efx_u25_vfrep_netdev_ops = {
 	.ndo_open		= efx_u25_vfrep_open,
 	.ndo_stop		= efx_u25_vfrep_close,
@@ -292,6 +493,12 @@ const struct net_device_ops efx_u25_vfrep_netdev_ops = {
 	.ndo_set_mac_address    = efx_u25_vfrep_set_mac_address,
 	.ndo_get_stats64	= efx_u25_vfrep_get_stats64,
 	.ndo_setup_tc		= efx_u25_vfrep_setup_tc,
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP)
+	.ndo_bpf		= efx_u25_vfrep_xdp,
+#endif
+#if defined(EFX_U25_VFREP_XDP_TX) && (!defined(EFX_USE_KCOMPAT) || (defined(EFX_HAVE_XDP_REDIR) && defined(EFX_HAVE_XDP_TX_FLAGS)))
+	.ndo_xdp_xmit		= efx_u25_vfrep_xdp_xmit,
+#endif
 };
 
 static void efx_u25_vfrep_get_drvinfo(struct net_device *dev,
@@ -314,10 +521,70 @@ static void efx_u25_vfrep_ethtool_set_msglevel(struct net_device *net_dev,
 	efv->msg_enable = msg_enable;
 }
 
+static const char efx_u25_vfrep_stat_names[][ETH_GSTRING_LEN] = {
+	"rx_gro_merged",
+	"rx_gro_held",
+	"rx_gro_normal",
+	"rx_gro_flushes",
+	"rx_xdp_drops",
+	"rx_xdp_bad_drops",
+	"rx_xdp_tx",
+	"rx_xdp_redirect",
+};
+
+#define EFX_U25_VFREP_N_STATS	ARRAY_SIZE(efx_u25_vfrep_stat_names)
+
+static int efx_u25_vfrep_ethtool_get_sset_count(struct net_device *net_dev,
+						int string_set)
+{
+	switch (string_set) {
+	case ETH_SS_STATS:
+		return EFX_U25_VFREP_N_STATS;
+	default:
+		return -EINVAL;
+	}
+}
+
+static void efx_u25_vfrep_ethtool_get_strings(struct net_device *net_dev,
+					      u32 string_set, u8 *strings)
+{
+	if (string_set == ETH_SS_STATS)
+		memcpy(strings, efx_u25_vfrep_stat_names,
+		       sizeof(efx_u25_vfrep_stat_names));
+}
+
+/* Sum the per-queue GRO counters, which are read without locking, and add
+ * the XDP counters kept for the whole representor.
+ */
+static void efx_u25_vfrep_ethtool_get_stats(struct net_device *net_dev,
+					    struct ethtool_stats *stats,
+					    u64 *data)
+{
+	struct efx_vfrep *efv = netdev_priv(net_dev);
+	unsigned int q;
+
+	memset(data, 0, EFX_U25_VFREP_N_STATS * sizeof(*data));
+	for (q = 0; q < efv->n_rxq; q++) {
+		struct efx_vfrep_rxq *rxq = &efv->rxq[q];
+
+		data[0] += READ_ONCE(rxq->n_rx_gro_merged);
+		data[1] += READ_ONCE(rxq->n_rx_gro_held);
+		data[2] += READ_ONCE(rxq->n_rx_gro_normal);
+		data[3] += READ_ONCE(rxq->n_rx_gro_flushes);
+	}
+	data[4] = atomic_read(&efv->stats.rx_xdp_drops);
+	data[5] = atomic_read(&efv->stats.rx_xdp_bad_drops);
+	data[6] = atomic_read(&efv->stats.rx_xdp_tx);
+	data[7] = atomic_read(&efv->stats.rx_xdp_redirect);
+}
+
 const static struct ethtool_ops efx_u25_vfrep_ethtool_ops = {
 	.get_drvinfo		= efx_u25_vfrep_get_drvinfo,
 	.get_msglevel		= efx_u25_vfrep_ethtool_get_msglevel,
 	.set_msglevel		= efx_u25_vfrep_ethtool_set_msglevel,
+	.get_sset_count		= efx_u25_vfrep_ethtool_get_sset_count,
+	.get_strings		= efx_u25_vfrep_ethtool_get_strings,
+	.get_ethtool_stats	= efx_u25_vfrep_ethtool_get_stats,
 };
 #if 0
 static struct efx_vfrep *efx_u25_vfrep_create_netdev(struct efx_nic *efx,
@@ -361,15 +628,49 @@ fail1:
 }
 #endif
 
+/* Representor TX goes out through the PF's queues, so offer the offloads
+ * they implement: checksum, scatter-gather and TSO (FATSOv2 or the
+ * firmware-assisted path in tx_tso.c, both of which parse the mport tags).
+ * RX checksum results come from the PF's RX prefix.
+ */
+static void efx_u25_vfrep_init_features(struct efx_nic *efx,
+					struct net_device *net_dev)
+{
+	struct efx_ef10_nic_data *nic_data = efx->nic_data;
+	netdev_features_t features;
+
+	features = NETIF_F_SG | NETIF_F_HIGHDMA | NETIF_F_TSO |
+		   NETIF_F_TSO_ECN | NETIF_F_RXCSUM |
+		   (efx->type->offload_features & NETIF_F_CSUM_MASK);
+#if !defined(EFX_USE_KCOMPAT) || defined(NETIF_F_IPV6_CSUM)
+	if (features & (NETIF_F_IPV6_CSUM | NETIF_F_HW_CSUM))
+		features |= NETIF_F_TSO6;
+#endif
+	net_dev->features |= features;
+	net_dev->hw_features |= features;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_GSO_MAX_SEGS)
+	net_dev->gso_max_segs = EFX_TSO_MAX_SEGS;
+#endif
+
+	/* Without descriptor tagging the tags are pushed into the skb, so
+	 * ask for the headroom and keep a GSO packet within 64k with them.
+	 */
+	if (!efx_ef10_has_cap(nic_data->datapath_caps, TX_VLAN_INSERTION)) {
+		net_dev->needed_headroom = EFX_U25_VFREP_TX_TAGS_LEN;
+		net_dev->gso_max_size = GSO_MAX_SIZE - EFX_U25_VFREP_TX_TAGS_LEN;
+	}
+}
+
 static struct efx_vfrep *efx_u25_vfrep_create_netdev(struct efx_nic *efx,
 		unsigned int i)
 {
 	struct net_device *net_dev;
 	struct efx_ef10_nic_data *nic_data = efx->nic_data;
 	struct efx_vfrep *efv;
+	unsigned int n_queues = efx_u25_vfrep_n_queues(efx);
 	int rc;
 
-	net_dev = alloc_etherdev_mq(sizeof(*efv), 1);
+	net_dev = alloc_etherdev_mqs(sizeof(*efv), n_queues, n_queues);
 	if (!net_dev)
 		return ERR_PTR(-ENOMEM);
 
@@ -395,16 +696,19 @@ static struct efx_vfrep *efx_u25_vfrep_create_netdev(struct efx_nic *efx,
 	net_dev->ethtool_ops = &efx_u25_vfrep_ethtool_ops;
 	net_dev->features |= NETIF_F_HW_TC;
 	net_dev->hw_features |= NETIF_F_HW_TC;
+	efx_u25_vfrep_init_features(efx, net_dev);
 	//eth_hw_addr_random(net_dev);
 	ether_addr_copy(net_dev->dev_addr, nic_data->vf[i].mac);
 	return efv;
 fail1:
+	kfree(efv->rxq);
 	free_netdev(net_dev);
 	return ERR_PTR(rc);
 }
 
 static void efx_u25_vfrep_destroy_netdev(struct efx_vfrep *efv)
 {
+	kfree(efv->rxq);
 	free_netdev(efv->net_dev);
 }
 
@@ -426,12 +730,17 @@ static int efx_u25_vfrep_tc_egdev_cb(enum tc_setup_type type, void *type_data,
 static int efx_u25_configure_rep(struct efx_vfrep *efv)
 {
 	struct efx_nic *efx = efv->parent;
+	struct efx_ef10_nic_data *nic_data = efx->nic_data;
 	u32 id;
 	int rc;
 
 	/* Construct mport selector for corresponding VF */
 	efx_mae_mport_vf(efx, efv->vf_idx, &id);
 	efv->vf_mport = id & 0xfff;
+	if (efx_ef10_has_cap(nic_data->datapath_caps, TX_VLAN_INSERTION))
+		efv->tx_mport_tags =
+			(U25_MPORT_TO_VLAN(nic_data->pf_mport) << 16) |
+			U25_MPORT_TO_VLAN(efv->vf_mport);
 
 	rtnl_lock();
 	efx_ef10_sriov_set_vf_vlan(efx, efv->vf_idx, 
@@ -506,6 +815,8 @@ int efx_u25_vfrep_create(struct efx_nic *efx, unsigned int i)
 	}
 	netif_dbg(efx, drv, efx->net_dev, "Representor for VF %d is %s\n", i,
 		  efv->net_dev->name);
+	if (nic_data->vfrep_by_mport)
+		rcu_assign_pointer(nic_data->vfrep_by_mport[efv->vf_mport], efv);
 	return 0;
 fail2:
 	efx_u25_deconfigure_rep(efv);
@@ -525,6 +836,12 @@ void efx_u25_vfrep_destroy(struct efx_nic *efx, unsigned int i)
 	if (!rep_dev)
 		return;
 	efv = netdev_priv(rep_dev);
+	/* Stop the RX path finding it before we tear it down */
+	if (nic_data->vfrep_by_mport &&
+	    rcu_access_pointer(nic_data->vfrep_by_mport[efv->vf_mport]) == efv) {
+		RCU_INIT_POINTER(nic_data->vfrep_by_mport[efv->vf_mport], NULL);
+		synchronize_net();
+	}
 	efx_u25_deconfigure_rep(efv);
 	nic_data->vf_rep[i] = NULL;
 	unregister_netdev(rep_dev);
@@ -559,9 +876,54 @@ void efx_u25_stop_reps(struct efx_nic *efx)
 #endif
 }
 
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_USE_GRO)
+static void efx_u25_vfrep_gro_account(struct efx_vfrep_rxq *rxq,
+				      gro_result_t gro_result)
+{
+	switch (gro_result) {
+	case GRO_MERGED:
+	case GRO_MERGED_FREE:
+		rxq->n_rx_gro_merged++;
+		break;
+	case GRO_HELD:
+		rxq->n_rx_gro_held++;
+		break;
+	case GRO_NORMAL:
+		rxq->n_rx_gro_normal++;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Pass a batch of skbs dequeued by efx_u25_vfrep_poll() through GRO */
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
+static void efx_u25_vfrep_gro_receive(struct efx_vfrep_rxq *rxq,
+				      struct list_head *head)
+{
+	struct sk_buff *skb, *next;
+
+	list_for_each_entry_safe(skb, next, head, list) {
+		skb_list_del_init(skb);
+		efx_u25_vfrep_gro_account(rxq, napi_gro_receive(&rxq->napi, skb));
+	}
+}
+#else
+static void efx_u25_vfrep_gro_receive(struct efx_vfrep_rxq *rxq,
+				      struct sk_buff_head *head)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(head)))
+		efx_u25_vfrep_gro_account(rxq, napi_gro_receive(&rxq->napi, skb));
+}
+#endif
+#endif
+
 static int efx_u25_vfrep_poll(struct napi_struct *napi, int weight)
 {
-	struct efx_vfrep *efv = container_of(napi, struct efx_vfrep, napi);
+	struct efx_vfrep_rxq *rxq = container_of(napi, struct efx_vfrep_rxq,
+						 napi);
 	unsigned int read_index;
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
 	struct list_head head;
@@ -577,104 +939,281 @@ static int efx_u25_vfrep_poll(struct napi_struct *napi, int weight)
 	__skb_queue_head_init(&head);
 #endif
 	/* Grab up to 'weight' pending SKBs */
-	spin_lock_bh(&efv->rx_lock);
-	read_index = efv->write_index;
+	spin_lock_bh(&rxq->rx_lock);
+	read_index = rxq->write_index;
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
-	while (spent < weight && !list_empty(&efv->rx_list)) {
-		skb = list_first_entry(&efv->rx_list, struct sk_buff, list);
+	while (spent < weight && !list_empty(&rxq->rx_list)) {
+		skb = list_first_entry(&rxq->rx_list, struct sk_buff, list);
 		list_del(&skb->list);
 		list_add_tail(&skb->list, &head);
 #else
 	while (spent < weight) {
-		skb = __skb_dequeue(&efv->rx_list);
+		skb = __skb_dequeue(&rxq->rx_list);
 		if (!skb)
 			break;
 		__skb_queue_tail(&head, skb);
 #endif
 		spent++;
 	}
-	spin_unlock_bh(&efv->rx_lock);
+	spin_unlock_bh(&rxq->rx_lock);
 	/* Receive them */
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_USE_GRO)
+	efx_u25_vfrep_gro_receive(rxq, &head);
+#else
 	netif_receive_skb_list(&head);
+#endif
 	if (spent < weight) {
-		if(napi_complete_done(napi, spent))
-			efv->read_index = efv->write_index;
+		if (napi_complete_done(napi, spent)) {
+			rxq->read_index = rxq->write_index;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_USE_GRO)
+			rxq->n_rx_gro_flushes++;
+#endif
+		}
 	}
 	return spent;
 }
 
-void efx_u25_vfrep_rx_packet(struct efx_vfrep *efv, struct efx_rx_buffer *rx_buf)
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP)
+/* Run the representor's XDP program on its frame in the PF RX page, after
+ * the mport tags have been stripped and before anything is copied.  Called
+ * with rcu_read_lock() held.
+ *
+ * Returns the XDP action.  For anything but XDP_PASS, the page has either
+ * been handed on (and rx_buf->page cleared) or is left for the caller to
+ * free.
+ */
+static u32 efx_u25_vfrep_xdp_rx(struct efx_vfrep *efv,
+				struct efx_vfrep_rxq *rxq,
+				struct efx_channel *channel,
+				struct efx_rx_buffer *rx_buf, u8 **ehp)
 {
+	struct efx_nic *efx = efv->parent;
+	struct bpf_prog *xdp_prog;
+#ifdef EFX_U25_VFREP_XDP_TX
+	struct xdp_frame *xdpf;
+#endif
+	struct xdp_buff xdp;
+	u32 xdp_act;
+	s16 offset;
+	int rc;
+
+	xdp_prog = rcu_dereference(efv->xdp_prog);
+	if (!xdp_prog)
+		return XDP_PASS;
+
+	if (unlikely(channel->rx_pkt_n_frags > 1)) {
+		/* We can't do XDP on fragmented packets - drop. */
+		if (net_ratelimit())
+			netif_err(efv, rx_err, efv->net_dev,
+				  "XDP is not possible with multiple receive fragments (%d)\n",
+				  channel->rx_pkt_n_frags);
+		atomic_inc(&efv->stats.rx_xdp_bad_drops);
+		return XDP_DROP;
+	}
+
+	/* dma_addr is still that of the tagged frame */
+	dma_sync_single_for_cpu(&efx->pci_dev->dev, rx_buf->dma_addr,
+				rx_buf->len + 2 * VLAN_HLEN, DMA_FROM_DEVICE);
+
+	xdp.data = *ehp;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_HEAD)
+	xdp.data_hard_start = xdp.data - XDP_PACKET_HEADROOM;
+#endif
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_DATA_META)
+	/* No support yet for XDP metadata */
+	xdp_set_data_meta_invalid(&xdp);
+#endif
+	xdp.data_end = xdp.data + rx_buf->len;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_RXQ_INFO)
+	xdp.rxq = &rxq->xdp_rxq_info;
+#endif
+
+	xdp_act = bpf_prog_run_xdp(xdp_prog, &xdp);
+	offset = (u8 *)xdp.data - *ehp;
+
+	switch (xdp_act) {
+	case XDP_PASS:
+		*ehp += offset;
+		rx_buf->page_offset += offset;
+		rx_buf->len = (u8 *)xdp.data_end - (u8 *)xdp.data;
+		break;
+
+#ifdef EFX_U25_VFREP_XDP_TX
+	case XDP_TX:
+		/* Back to the VF, tagged with its mport */
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_COVERT_XDP_BUFF_FRAME_API)
+		xdpf = xdp_convert_buff_to_frame(&xdp);
+#else
+		xdpf = convert_to_xdp_frame(&xdp);
+#endif
+		rc = -ENOSPC;
+		if (xdpf && !efx_u25_vfrep_xdp_push_tags(efv, xdpf))
+			rc = efx_xdp_tx_buffers(efx, 1, &xdpf, true);
+		if (rc != 1) {
+			if (net_ratelimit())
+				netif_err(efv, rx_err, efv->net_dev,
+					  "XDP TX failed (%d)\n", rc);
+			atomic_inc(&efv->stats.rx_xdp_bad_drops);
+			xdp_act = XDP_DROP;
+		} else {
+			/* Buffer ownership passed to tx */
+			rx_buf->page = NULL;
+			atomic_inc(&efv->stats.rx_xdp_tx);
+		}
+		break;
+#endif
+
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP_REDIR)
+	case XDP_REDIRECT:
+		/* To another representor, the PF or any other XDP target;
+		 * flushed at the end of the PF channel's NAPI poll.
+		 */
+		rc = xdp_do_redirect(efv->net_dev, &xdp, xdp_prog);
+		if (rc) {
+			if (net_ratelimit())
+				netif_err(efv, rx_err, efv->net_dev,
+					  "XDP redirect failed (%d)\n", rc);
+			atomic_inc(&efv->stats.rx_xdp_bad_drops);
+			xdp_act = XDP_DROP;
+		} else {
+			rx_buf->page = NULL;
+			atomic_inc(&efv->stats.rx_xdp_redirect);
+		}
+		break;
+#endif
+
+	default:
+		bpf_warn_invalid_xdp_action(xdp_act);
+		/* Fall through */
+	case XDP_ABORTED:
+		trace_xdp_exception(efv->net_dev, xdp_prog, xdp_act);
+		atomic_inc(&efv->stats.rx_xdp_bad_drops);
+		break;
+
+	case XDP_DROP:
+		atomic_inc(&efv->stats.rx_xdp_drops);
+		break;
+	}
+
+	return xdp_act;
+}
+#endif
+
+/* Build an skb for a representor around the RX page fragment(s), copying
+ * only the headers, as efx_rx_mk_skb() does for the PF.  The pages are
+ * handed to the skb, so they go back through the RX recycle ring once the
+ * stack is done with them.  Any buffer whose page is not consumed here is
+ * left for the caller to free.
+ */
+void efx_u25_vfrep_rx_packet(struct efx_vfrep *efv, struct efx_channel *channel,
+			     struct efx_rx_buffer *rx_buf)
+{
+	unsigned int n_frags = channel->rx_pkt_n_frags;
+	u16 rx_buf_flags = rx_buf->flags;
+	struct efx_nic *efx = efv->parent;
 	u8 *eh = efx_rx_buf_va(rx_buf);
+	struct efx_vfrep_rxq *rxq;
+	unsigned int hdr_len;
 	struct sk_buff *skb;
+	unsigned int index;
 	bool primed;
-	int offset;
-	u16 tci;
 
-	skb = netdev_alloc_skb(efv->net_dev, rx_buf->len);
-	if (!skb) {
+	if (unlikely(rx_buf->len < ETH_HLEN + 2 * VLAN_HLEN)) {
 		atomic_inc(&efv->stats.rx_dropped);
-		netif_dbg(efv->parent, rx_err, efv->net_dev,
+		return;
+	}
+
+	/* Strip the outer (PF) and inner (VF) VLAN tags by moving the MAC
+	 * addresses up over them, rather than popping them off an skb.
+	 */
+	memmove(eh + 2 * VLAN_HLEN, eh, 2 * ETH_ALEN);
+	eh += 2 * VLAN_HLEN;
+	rx_buf->page_offset += 2 * VLAN_HLEN;
+	rx_buf->len -= 2 * VLAN_HLEN;
+
+	/* Deliver on the representor queue matching the PF channel */
+	index = channel->channel % efv->n_rxq;
+	rxq = &efv->rxq[index];
+
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_XDP)
+	if (efx_u25_vfrep_xdp_rx(efv, rxq, channel, rx_buf, &eh) != XDP_PASS)
+		return;
+#endif
+
+	hdr_len = min_t(unsigned int, rx_buf->len, EFX_U25_VFREP_RX_CB_LEN);
+	skb = netdev_alloc_skb(efv->net_dev, efx->rx_ip_align + hdr_len);
+	if (unlikely(!skb)) {
+		atomic_inc(&efv->stats.rx_dropped);
+		netif_dbg(efx, rx_err, efv->net_dev,
 			  "noskb-dropped packet of length %u\n", rx_buf->len);
 		return;
 	}
-	memcpy(skb->data, eh, rx_buf->len);
-	__skb_put(skb, rx_buf->len);
+	skb_reserve(skb, efx->rx_ip_align);
+	memcpy(__skb_put(skb, hdr_len), eh, hdr_len);
+
+	/* Append the rest of the first page and any further pages */
+	if (rx_buf->len > hdr_len) {
+		rx_buf->page_offset += hdr_len;
+		rx_buf->len -= hdr_len;
+
+		for (;;) {
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB_FRAG_TRUESIZE)
+			skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags,
+					rx_buf->page, rx_buf->page_offset,
+					rx_buf->len, efx->rx_buffer_truesize);
+#else
+			skb_add_rx_frag(skb, skb_shinfo(skb)->nr_frags,
+					rx_buf->page, rx_buf->page_offset,
+					rx_buf->len);
+#endif
+			rx_buf->page = NULL;
+			if (skb_shinfo(skb)->nr_frags == n_frags)
+				break;
+
+			rx_buf = efx_rx_buf_next(&channel->rx_queue, rx_buf);
+		}
+	}
 
-	skb_record_rx_queue(skb, 0); /* vfrep is single-queue */
+	skb_record_rx_queue(skb, index);
+	atomic_inc(&efv->stats.rx_packets);
+	atomic_add(skb->len, &efv->stats.rx_bytes);
 
 	/* Move past the ethernet header */
 	skb->protocol = eth_type_trans(skb, efv->net_dev);
-	/* Pull outer VLAN header */
-	offset = skb->data - skb_mac_header(skb);
-	__skb_push(skb, offset);
-	__skb_vlan_pop(skb, &tci);
-	__skb_pull(skb, offset);
-	/* Pull inner VLAN header */
-	offset = skb->data - skb_mac_header(skb);
-	__skb_push(skb, offset);
-	__skb_vlan_pop(skb, &tci);
-	__skb_pull(skb, offset);
-
 	skb_checksum_none_assert(skb);
-	atomic_inc(&efv->stats.rx_packets);
-	atomic_add(rx_buf->len, &efv->stats.rx_bytes);
+	if (likely((rx_buf_flags & EFX_RX_PKT_CSUMMED) &&
+		   (efv->net_dev->features & NETIF_F_RXCSUM))) {
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+#if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_CSUM_LEVEL)
+		skb->csum_level = !!(rx_buf_flags & EFX_RX_PKT_CSUM_LEVEL);
+#endif
+	}
 
 	/* Add it to the rx list */
-	spin_lock_bh(&efv->rx_lock);
-	primed = efv->read_index == efv->write_index;
+	spin_lock_bh(&rxq->rx_lock);
+	primed = rxq->read_index == rxq->write_index;
 #if !defined(EFX_USE_KCOMPAT) || defined(EFX_HAVE_SKB__LIST)
-	list_add_tail(&skb->list, &efv->rx_list);
+	list_add_tail(&skb->list, &rxq->rx_list);
 #else
-	__skb_queue_tail(&efv->rx_list, skb);
+	__skb_queue_tail(&rxq->rx_list, skb);
 #endif
-	efv->write_index++;
-	spin_unlock_bh(&efv->rx_lock);
+	rxq->write_index++;
+	spin_unlock_bh(&rxq->rx_lock);
 	/* Trigger rx work */
 	if (primed) 
-		napi_schedule(&efv->napi);
+		napi_schedule(&rxq->napi);
 }
 
-/* Returns the representor netdevice corresponding to a VF m-port, or NULL.
+/* Returns the representor corresponding to a VF m-port, or NULL.
  * @mport is an m-port label, *not* an m-port ID!
  */
-struct net_device *efx_u25_find_vfrep_by_mport(struct efx_nic *efx, u16 mport)
+struct efx_vfrep *efx_u25_find_vfrep_by_mport(struct efx_nic *efx, u16 mport)
 {
-#if defined(CONFIG_SFC_SRIOV)
 	struct efx_ef10_nic_data *nic_data = efx->nic_data;
-	struct efx_vfrep *efv;
-	unsigned int i;
-
-	if (nic_data->vf_rep)
-		for (i = 0; i < efx->vf_count; i++) {
-			if (!nic_data->vf_rep[i])
-				continue;
-			efv = netdev_priv(nic_data->vf_rep[i]);
-			if (efv->vf_mport == mport)
-				return nic_data->vf_rep[i];
-		}
-#endif
-	return NULL;
+
+	if (unlikely(!nic_data->vfrep_by_mport || mport >= U25_MPORT_LABELS))
+		return NULL;
+	return rcu_dereference(nic_data->vfrep_by_mport[mport]);
 }
 
 #if defined(CONFIG_SFC_SRIOV)
@@ -694,11 +1233,14 @@ int efx_u25_vf_filter_insert(struct efx_nic *efx, unsigned int i)
 		//flags = EFX_FILTER_FLAG_RX_RSS;
 		//u16 inner_vlan = U25_MPORT_TO_VLAN(efv->vf_mport);
 
-		efx_filter_init_rx(&spec, EFX_FILTER_PRI_REQUIRED, 0, 
+		/* Spread slow-path traffic over the PF channels so that each
+		 * representor RX queue is fed from its own channel.
+		 */
+		efx_filter_init_rx(&spec, EFX_FILTER_PRI_REQUIRED,
+				EFX_FILTER_FLAG_RX_RSS,
 				efx_rx_queue_index(efx_channel_get_rx_queue(channel)));
 
                 spec.match_flags |= EFX_FILTER_MATCH_LOC_MAC_IG;
-//		spec.match_flags |= EFX_FILTER_FLAG_RX_RSS;
 //	       	ether_addr_copy(spec.loc_mac, nic_data->vf[i].mac);
 		//spec.match_flags |= EFX_FILTER_MATCH_IP_PROTO;
 		//spec.match_flags |= EFX_FILTER_MATCH_ETHER_TYPE;
@@ -767,12 +1309,13 @@ void efx_u25_vfrep_destroy(struct efx_nic *efx, unsigned int i)
 
 const struct net_device_ops efx_u25_vfrep_netdev_ops = {};
 
-void efx_u25_vfrep_rx_packet(struct efx_vfrep *efv, struct efx_rx_buffer *rx_buf)
+void efx_u25_vfrep_rx_packet(struct efx_vfrep *efv, struct efx_channel *channel,
+			     struct efx_rx_buffer *rx_buf)
 {
 	WARN_ON_ONCE(1);
 }
 
-struct net_device *efx_u25_find_vfrep_by_mport(struct efx_nic *efx, u16 mport)
+struct efx_vfrep *efx_u25_find_vfrep_by_mport(struct efx_nic *efx, u16 mport)
 {
 	return NULL;
 }
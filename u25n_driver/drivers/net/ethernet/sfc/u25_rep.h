@@ -19,10 +19,27 @@ int efx_u25_vfrep_create(struct efx_nic *efx, unsigned int i);
 void efx_u25_vfrep_destroy(struct efx_nic *efx, unsigned int i);
 int efx_u25_vf_filter_insert(struct efx_nic *efx, unsigned int i);
 
-/* Returns the representor netdevice owning a dynamic m-port, or NULL */
-struct net_device *efx_u25_find_vfrep_by_mport(struct efx_nic *efx, u16 mport);
+/* Returns the representor owning a dynamic m-port, or NULL.  Caller must
+ * hold rcu_read_lock().
+ */
+struct efx_vfrep *efx_u25_find_vfrep_by_mport(struct efx_nic *efx, u16 mport);
 
-void efx_u25_vfrep_rx_packet(struct efx_vfrep *efv, struct efx_rx_buffer *rx_buf);
+void efx_u25_vfrep_rx_packet(struct efx_vfrep *efv, struct efx_channel *channel,
+			     struct efx_rx_buffer *rx_buf);
 void pkt_hex_dump(uint8_t *data, char *func);
 extern const struct net_device_ops efx_u25_vfrep_netdev_ops;
+
+/* VLAN tags the hardware must insert to send @skb to its mport: non-zero
+ * only for packets transmitted by a representor using descriptor tagging.
+ */
+static inline u32 efx_u25_vfrep_tx_tags(struct sk_buff *skb)
+{
+	if (unlikely(skb->dev &&
+		     skb->dev->netdev_ops == &efx_u25_vfrep_netdev_ops)) {
+		struct efx_vfrep *efv = netdev_priv(skb->dev);
+
+		return efv->tx_mport_tags;
+	}
+	return 0;
+}
 #endif /* U25_REP_H */
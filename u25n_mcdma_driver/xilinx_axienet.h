@@ -626,6 +626,7 @@ enum axienet_tsn_ioctl {
  * @regs:	Base address for the axienet_local device address space
  * @mcdma_regs:	Base address for the aximcdma device address space
  * @napi:	Napi Structure array for all dma queues
+ * @napi_tx:	Napi Structure array for MCDMA Tx completion, per dma queue
  * @num_tx_queues: Total number of Tx DMA queues
  * @num_rx_queues: Total number of Rx DMA queues
  * @dq:		DMA queues data
@@ -705,10 +706,30 @@ struct axienet_local {
 	struct sock *nl_sk;
 	struct workqueue_struct *grant_work_q;
         struct delayed_work grant_work;
+	/* Counter stream flow control; see axienet_counter_packet_handler() */
+	spinlock_t counter_lock;
+	u16 counter_seq;
+	u16 counter_limit;
+	bool counter_paced;
+	unsigned long counter_last_ack;
+	unsigned long counter_sent;
+	unsigned long counter_dropped;
+	unsigned long counter_ack_timeouts;
+	/* Counter coalescing; see axienet_counter_coalesce() */
+	struct sk_buff *counter_agg;
+	u16 counter_agg_n;
+	u8 counter_agg_poff;
+	struct timer_list counter_timer;
+	unsigned int counter_coalesce_usecs;
+	unsigned int counter_coalesce_entries;
+	unsigned long counter_coalesced;
 
 #endif
 	struct tasklet_struct dma_err_tasklet[XAE_MAX_QUEUES];
 	struct napi_struct napi[XAE_MAX_QUEUES];	/* NAPI Structure */
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+	struct napi_struct napi_tx[XAE_MAX_QUEUES];	/* Tx NAPI Structure */
+#endif
 
 	#define XAE_TEMAC1 0
 	#define XAE_TEMAC2 1
@@ -785,6 +806,44 @@ struct axienet_local {
 	u32 usxgmii_rate;
 };
 
+/**
+ * enum axienet_chan_role - What an MCDMA channel carries
+ * @AXIENET_CHAN_ROLE_CONTROL: eMCDI requests from the host for the agents;
+ *	anything else is given to the stack
+ * @AXIENET_CHAN_ROLE_COUNTER: Counter stream to forward to the host
+ * @AXIENET_CHAN_ROLE_LOGS: eMCDI logger requests for the logs agent;
+ *	anything else is dropped
+ * @AXIENET_CHAN_ROLE_DATA: Plain network traffic, given to the stack
+ */
+enum axienet_chan_role {
+	AXIENET_CHAN_ROLE_CONTROL,
+	AXIENET_CHAN_ROLE_COUNTER,
+	AXIENET_CHAN_ROLE_LOGS,
+	AXIENET_CHAN_ROLE_DATA,
+	AXIENET_CHAN_ROLE_MAX,
+};
+
+/* Channel carrying the counter stream unless "xlnx,channel-roles" says */
+#define AXIENET_COUNTER_CHAN_ID		3
+
+/**
+ * struct axienet_rx_page - A mapped page backing one MCDMA RX BD
+ * @page:	The page; each half holds one frame and its skb_shared_info
+ * @dma:	DMA address of the whole page, mapped once when allocated
+ * @offset:	Offset of the half currently given to the hardware
+ */
+struct axienet_rx_page {
+	struct page *page;
+	dma_addr_t dma;
+	unsigned int offset;
+};
+
+/* Each RX page is split in two buffers, so that one can be handed to the
+ * stack while the other is given back to the hardware.
+ */
+#define AXIENET_RX_BUF_TRUESIZE		(PAGE_SIZE / 2)
+#define AXIENET_RX_HEADROOM		NET_SKB_PAD
+
 /**
  * struct axienet_dma_q - axienet private per dma queue data
  * @lp:		Parent pointer
@@ -818,6 +877,14 @@ struct axienet_local {
  * @tx_bytes:   Number of transmit bytes processed by the dma queue.
  * @rx_packets: Number of receive packets processed by the dma queue.
  * @rx_bytes:	Number of receive bytes processed by the dma queue.
+ * @rx_pages:	Page-recycling RX buffers, one per MCDMA RX BD, or NULL if
+ *		frames are too large to fit and skbs are used instead.
+ * @rx_page_reuse: Number of RX buffers served by flipping to the other
+ *		half of an already mapped page.
+ * @rx_page_alloc: Number of RX pages allocated and mapped after start-up.
+ *		Both are reported through the rx_page_stats sysfs file.
+ * @role:	What the MCDMA channel carries, see enum axienet_chan_role.
+ * @cpu:	CPU the channel's IRQs (and so its NAPI) are pinned to, or -1.
  */
 struct axienet_dma_q {
 	struct axienet_local	*lp; /* parent */
@@ -854,10 +921,22 @@ struct axienet_dma_q {
 	unsigned long tx_bytes;
 	unsigned long rx_packets;
 	unsigned long rx_bytes;
+
+	struct axienet_rx_page *rx_pages;
+	unsigned long rx_page_reuse;
+	unsigned long rx_page_alloc;
+
+	u8 role;
+	int cpu;
 };
 
 #define AXIENET_TX_SSTATS_LEN(lp) ((lp)->num_tx_queues * 2)
 #define AXIENET_RX_SSTATS_LEN(lp) ((lp)->num_rx_queues * 2)
+#ifndef XILINX_MAC_DEBUG
+#define AXIENET_COUNTER_SSTATS_LEN 5
+#else
+#define AXIENET_COUNTER_SSTATS_LEN 0
+#endif
 
 /**
  * enum axienet_ip_type - AXIENET IP/MAC type.
@@ -1073,7 +1152,8 @@ int __maybe_unused axienet_dma_q_init(struct net_device *ndev,
 void axienet_dma_err_handler(unsigned long data);
 irqreturn_t __maybe_unused axienet_tx_irq(int irq, void *_ndev);
 irqreturn_t __maybe_unused axienet_rx_irq(int irq, void *_ndev);
-void axienet_start_xmit_done(struct net_device *ndev, struct axienet_dma_q *q);
+int axienet_start_xmit_done(struct net_device *ndev, struct axienet_dma_q *q,
+			    int budget);
 void axienet_dma_bd_release(struct net_device *ndev);
 void __axienet_device_reset(struct axienet_dma_q *q);
 void axienet_set_mac_address(struct net_device *ndev, const void *address);
@@ -1089,7 +1169,14 @@ void __maybe_unused axienet_mcdma_tx_bd_free(struct net_device *ndev,
 					     struct axienet_dma_q *q);
 void __maybe_unused axienet_mcdma_rx_bd_free(struct net_device *ndev,
 					     struct axienet_dma_q *q);
+struct sk_buff *axienet_mcdma_rx_page_skb(struct net_device *ndev,
+					  struct axienet_dma_q *q,
+					  u32 length);
+void axienet_mcdma_rx_page_refill(struct net_device *ndev,
+				  struct axienet_dma_q *q,
+				  struct aximcdma_bd *cur_p);
 irqreturn_t __maybe_unused axienet_mcdma_tx_irq(int irq, void *_ndev);
+int axienet_mcdma_tx_poll(struct napi_struct *napi, int budget);
 irqreturn_t __maybe_unused axienet_mcdma_rx_irq(int irq, void *_ndev);
 void __maybe_unused axienet_mcdma_err_handler(unsigned long data);
 void axienet_strings(struct net_device *ndev, u32 sset, u8 *data);
@@ -1105,6 +1192,9 @@ int __maybe_unused axienet_mcdma_tx_probe(struct platform_device *pdev,
 int __maybe_unused axienet_mcdma_rx_probe(struct platform_device *pdev,
 					  struct axienet_local *lp,
 					  struct net_device *ndev);
+void axienet_mcdma_chan_config(struct platform_device *pdev,
+			       struct axienet_dma_q *q, int i);
+void axienet_mcdma_set_affinity(struct axienet_dma_q *q, int irq);
 #endif
 
 #ifdef CONFIG_AXIENET_HAS_MCDMA
@@ -272,7 +272,7 @@ irqreturn_t __maybe_unused axienet_tx_irq(int irq, void *_ndev)
 	status = axienet_dma_in32(q, XAXIDMA_TX_SR_OFFSET);
 	if (status & (XAXIDMA_IRQ_IOC_MASK | XAXIDMA_IRQ_DELAY_MASK)) {
 		axienet_dma_out32(q, XAXIDMA_TX_SR_OFFSET, status);
-		axienet_start_xmit_done(lp->ndev, q);
+		axienet_start_xmit_done(lp->ndev, q, 0);
 		goto out;
 	}
 
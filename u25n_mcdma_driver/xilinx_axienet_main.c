@@ -50,6 +50,7 @@
 #ifndef XILINX_MAC_DEBUG
 //#include "xilinx_axienet.h"
 #include "xilinx_axienet_mcdi.h"
+#include "xilinx_axienet_ring.h"
 #endif
 #ifdef CONFIG_XILINX_TSN_PTP
 #include "xilinx_tsn_ptp.h"
@@ -761,15 +762,20 @@ static void axienet_rx_hwtstamp(struct axienet_local *lp,
  * Axi DMA Tx channel.
  * @ndev:	Pointer to the net_device structure
  * @q:		Pointer to DMA queue structure
+ * @budget:	NAPI budget, or 0 when called from the Axi DMA Tx isr
  *
- * This function is invoked from the Axi DMA Tx isr to notify the completion
- * of transmit operation. It clears fields in the corresponding Tx BDs and
- * unmaps the corresponding buffer so that CPU can regain ownership of the
- * buffer. It finally invokes "netif_wake_queue" to restart transmission if
- * required.
+ * This function is invoked from the Axi DMA Tx isr, or from the MCDMA Tx
+ * NAPI poll, to notify the completion of transmit operation. It clears fields
+ * in the corresponding Tx BDs and unmaps the corresponding buffer so that CPU
+ * can regain ownership of the buffer. At most @budget BDs are processed when
+ * @budget is non-zero. Without MCDMA it finally invokes
+ * "netif_tx_wake_all_queues" to restart transmission; with MCDMA the poll
+ * routine wakes only the queue it serves.
+ *
+ * Return: Number of BDs processed.
  */
-void axienet_start_xmit_done(struct net_device *ndev,
-		struct axienet_dma_q *q)
+int axienet_start_xmit_done(struct net_device *ndev,
+		struct axienet_dma_q *q, int budget)
 {
 	u32 size = 0;
 	u32 packets = 0;
@@ -792,7 +798,8 @@ void axienet_start_xmit_done(struct net_device *ndev,
 #endif
 
 	//printk("%s--> chan_id: %hu\n", __func__, q->chan_id);
-	while (status & XAXIDMA_BD_STS_COMPLETE_MASK) {
+	while ((status & XAXIDMA_BD_STS_COMPLETE_MASK) &&
+			(!budget || packets < budget)) {
 #ifdef CONFIG_XILINX_AXI_EMAC_HWTSTAMP
 		if (cur_p->ptp_tx_skb)
 			axienet_tx_hwtstamp(lp, cur_p);
@@ -809,10 +816,8 @@ void axienet_start_xmit_done(struct net_device *ndev,
 					DMA_TO_DEVICE);
 		if (cur_p->tx_skb) {
 			skb = ((struct sk_buff *)cur_p->tx_skb);
-			//printk("Queue mapping: %hu\n", ((struct sk_buff *)cur_p->tx_skb)->queue_mapping);
-			//dev_kfree_skb_irq((struct sk_buff *)cur_p->tx_skb);
-			dev_kfree_skb_any(skb);
-			//printk("Freed skb in %s\n", __func__);
+			/* Batched into the per-cpu NAPI cache when polled */
+			napi_consume_skb(skb, budget);
 		}
 		cur_p->phys = 0;
 		cur_p->app0 = 0;
@@ -844,17 +849,51 @@ void axienet_start_xmit_done(struct net_device *ndev,
 	q->tx_packets += packets;
 	q->tx_bytes += size;
 
-	/* Matches barrier in axienet_start_xmit */
+	/* Matches barrier in axienet_queue_xmit */
 	smp_mb();
 
-	/* Fixme: With the existing multiqueue implementation
-	 * in the driver it is difficult to get the exact queue info.
-	 * We should wake only the particular queue
-	 * instead of waking all ndev queues.
-	 */
+#ifndef CONFIG_AXIENET_HAS_MCDMA
 	netif_tx_wake_all_queues(ndev);
+#endif
+	return packets;
 }
 
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+/**
+ * axienet_mcdma_tx_poll - Poll routine for MCDMA tx completions (NAPI)
+ * @napi:	napi structure pointer
+ * @budget:	Max number of tx BDs to be reclaimed.
+ *
+ * Reclaims completed Tx BDs of one dma queue and wakes only the netdev
+ * queue feeding it, then re-enables the Tx interrupt once the ring is clean.
+ *
+ * Return: number of BDs reclaimed
+ */
+int axienet_mcdma_tx_poll(struct napi_struct *napi, int budget)
+{
+	struct net_device *ndev = napi->dev;
+	struct axienet_local *lp = netdev_priv(ndev);
+	int map = napi - lp->napi_tx;
+	struct axienet_dma_q *q = lp->dq[map];
+	int work_done;
+	u32 cr;
+
+	work_done = axienet_start_xmit_done(ndev, q, budget);
+
+	if (work_done && __netif_subqueue_stopped(ndev, map))
+		netif_wake_subqueue(ndev, map);
+
+	if (work_done < budget && napi_complete_done(napi, work_done)) {
+		/* Enable the interrupts again */
+		cr = axienet_dma_in32(q, XMCDMA_CHAN_CR_OFFSET(q->chan_id));
+		cr |= (XMCDMA_IRQ_IOC_MASK | XMCDMA_IRQ_DELAY_MASK);
+		axienet_dma_out32(q, XMCDMA_CHAN_CR_OFFSET(q->chan_id), cr);
+	}
+
+	return work_done;
+}
+#endif
+
 /**
  * axienet_check_tx_bd_space - Checks if a BD/group of BDs are currently busy
  * @q:		Pointer to DMA queue structure
@@ -1144,12 +1183,12 @@ static int axienet_queue_xmit(struct sk_buff *skb,
 
 	spin_lock_irqsave(&q->tx_lock, flags);
 	if (axienet_check_tx_bd_space(q, num_frag)) {
-		if (netif_queue_stopped(ndev)) {
+		if (__netif_subqueue_stopped(ndev, map)) {
 			spin_unlock_irqrestore(&q->tx_lock, flags);
 			return NETDEV_TX_BUSY;
 		}
 
-		netif_stop_queue(ndev);
+		netif_stop_subqueue(ndev, map);
 
 		/* Matches barrier in axienet_start_xmit_done */
 		smp_mb();
@@ -1160,7 +1199,7 @@ static int axienet_queue_xmit(struct sk_buff *skb,
 			return NETDEV_TX_BUSY;
 		}
 
-		netif_wake_queue(ndev);
+		netif_wake_subqueue(ndev, map);
 	}
 
 #ifdef CONFIG_XILINX_AXI_EMAC_HWTSTAMP
@@ -1324,10 +1363,32 @@ static int axienet_recv(struct net_device *ndev, int budget,
 
 	while ((numbdfree < budget) &&
 			(cur_p->status & XAXIDMA_BD_STS_COMPLETE_MASK)) {
-		new_skb = netdev_alloc_skb(ndev, lp->max_frm_size);
-		if (!new_skb) {
-			dev_err(lp->dev, "No memory for new_skb\n");
-			break;
+		if (lp->eth_hasnobuf ||
+				(lp->axienet_config->mactype != XAXIENET_1G))
+			length = cur_p->status & XAXIDMA_BD_STS_ACTUAL_LEN_MASK;
+		else
+			length = cur_p->app4 & 0x0000FFFF;
+
+		new_skb = NULL;
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+		if (q->rx_pages) {
+			skb = axienet_mcdma_rx_page_skb(ndev, q, length);
+			if (!skb) {
+				dev_err(lp->dev, "No memory for rx page\n");
+				break;
+			}
+		} else
+#endif
+		{
+			new_skb = netdev_alloc_skb(ndev, lp->max_frm_size);
+			if (!new_skb) {
+				dev_err(lp->dev, "No memory for new_skb\n");
+				break;
+			}
+			dma_unmap_single(ndev->dev.parent, cur_p->phys,
+					lp->max_frm_size,
+					DMA_FROM_DEVICE);
+			skb = (struct sk_buff *)(cur_p->sw_id_offset);
 		}
 #ifdef CONFIG_AXIENET_HAS_MCDMA
 		tail_p = q->rx_bd_p + sizeof(*q->rxq_bd_v) * q->rx_bd_ci;
@@ -1335,18 +1396,6 @@ static int axienet_recv(struct net_device *ndev, int budget,
 		tail_p = q->rx_bd_p + sizeof(*q->rx_bd_v) * q->rx_bd_ci;
 #endif
 
-		dma_unmap_single(ndev->dev.parent, cur_p->phys,
-				lp->max_frm_size,
-				DMA_FROM_DEVICE);
-
-		skb = (struct sk_buff *)(cur_p->sw_id_offset);
-
-		if (lp->eth_hasnobuf ||
-				(lp->axienet_config->mactype != XAXIENET_1G))
-			length = cur_p->status & XAXIDMA_BD_STS_ACTUAL_LEN_MASK;
-		else
-			length = cur_p->app4 & 0x0000FFFF;
-
 		skb_put(skb, length);
 #ifdef CONFIG_XILINX_AXI_EMAC_HWTSTAMP
 		if (!lp->is_tsn) {
@@ -1383,11 +1432,21 @@ static int axienet_recv(struct net_device *ndev, int budget,
 
 #ifndef XILINX_MAC_DEBUG
 
-		if(q->chan_id == 3) {
+		if (q->role == AXIENET_CHAN_ROLE_COUNTER) {
 			axienet_counter_packet_handler(lp, skb);
 
+		} else if (q->role == AXIENET_CHAN_ROLE_LOGS) {
+			if (axienet_emcdi_logs_handler(lp, skb, q->chan_id)) {
+				dev_kfree_skb(skb);
+				ndev->stats.rx_dropped++;
+			} else {
+				emcdi_packet++;
+			}
 		} else {
-			ret = axienet_emcdi_packet_handler(lp ,skb, q->chan_id);
+			ret = -EIO;
+			if (q->role != AXIENET_CHAN_ROLE_DATA)
+				ret = axienet_emcdi_packet_handler(lp ,skb,
+								   q->chan_id);
 			if( ret ) {
 				//pr_info("%s:Not mcdi packet\n",__func__);
 
@@ -1428,12 +1487,19 @@ static int axienet_recv(struct net_device *ndev, int budget,
 		 */
 		wmb();
 
-		cur_p->phys = dma_map_single(ndev->dev.parent, new_skb->data,
-				lp->max_frm_size,
-				DMA_FROM_DEVICE);
-		cur_p->cntrl = lp->max_frm_size;
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+		if (q->rx_pages) {
+			axienet_mcdma_rx_page_refill(ndev, q, cur_p);
+		} else
+#endif
+		{
+			cur_p->phys = dma_map_single(ndev->dev.parent,
+					new_skb->data, lp->max_frm_size,
+					DMA_FROM_DEVICE);
+			cur_p->cntrl = lp->max_frm_size;
+			cur_p->sw_id_offset = (phys_addr_t)new_skb;
+		}
 		cur_p->status = 0;
-		cur_p->sw_id_offset = (phys_addr_t)new_skb;
 
 		if (++q->rx_bd_ci >= lp->rx_bd_num)
 			q->rx_bd_ci = 0;
@@ -1686,13 +1752,23 @@ static int axienet_open(struct net_device *ndev)
 		for_each_tx_dma_queue(lp, i) {
 			struct axienet_dma_q *q = lp->dq[i];
 #ifdef CONFIG_AXIENET_HAS_MCDMA
+			/* As for Rx, Tx NAPI must be enabled before its IRQ */
+			napi_enable(&lp->napi_tx[i]);
 			/* Enable interrupts for Axi MCDMA Tx */
 			ret = request_irq(q->tx_irq, axienet_mcdma_tx_irq,
 					IRQF_SHARED, ndev->name, ndev);
 			//pr_info("Func: %s ***DEBUG**** request_irq_tx[%d] ret: %d\n", __func__, i, ret); 
 			if (ret) {
+				napi_disable(&lp->napi_tx[i]);
+				while (i--) {
+					irq_set_affinity_hint(lp->dq[i]->tx_irq,
+							      NULL);
+					free_irq(lp->dq[i]->tx_irq, ndev);
+					napi_disable(&lp->napi_tx[i]);
+				}
 				goto err_tx_irq;
 			}
+			axienet_mcdma_set_affinity(q, q->tx_irq);
 #else
 			/* Enable interrupts for Axi DMA Tx */
 			ret = request_irq(q->tx_irq, axienet_tx_irq,
@@ -1712,6 +1788,7 @@ static int axienet_open(struct net_device *ndev)
 			if (ret) {
 				goto err_rx_irq;
 			}
+			axienet_mcdma_set_affinity(q, q->rx_irq);
 #else
 			/* Enable interrupts for Axi DMA Rx */
 			ret = request_irq(q->rx_irq, axienet_rx_irq,
@@ -1831,13 +1908,22 @@ static int axienet_open(struct net_device *ndev)
 err_eth_irq:
 	while (i--) {
 		q = lp->dq[i];
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+		irq_set_affinity_hint(q->rx_irq, NULL);
+#endif
 		free_irq(q->rx_irq, ndev);
 	}
 	i = lp->num_tx_queues;
 err_rx_irq:
 	while (i--) {
 		q = lp->dq[i];
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+		irq_set_affinity_hint(q->tx_irq, NULL);
+#endif
 		free_irq(q->tx_irq, ndev);
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+		napi_disable(&lp->napi_tx[i]);
+#endif
 	}
 err_tx_irq:
 	for_each_rx_dma_queue(lp, i)
@@ -1919,8 +2005,14 @@ static int axienet_stop(struct net_device *ndev)
 				axienet_mdio_enable(lp);
 				mutex_unlock(&lp->mii_bus->mdio_lock);
 			}
+#endif
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+			irq_set_affinity_hint(q->tx_irq, NULL);
 #endif
 			free_irq(q->tx_irq, ndev);
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+			napi_disable(&lp->napi_tx[i]);
+#endif
 		}
 
 		for_each_rx_dma_queue(lp, i) {
@@ -1928,6 +2020,9 @@ static int axienet_stop(struct net_device *ndev)
 			netif_stop_queue(ndev);
 			napi_disable(&lp->napi[i]);
 			tasklet_kill(&lp->dma_err_tasklet[i]);
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+			irq_set_affinity_hint(q->rx_irq, NULL);
+#endif
 			free_irq(q->rx_irq, ndev);
 		}
 #ifdef CONFIG_XILINX_TSN_PTP
@@ -2614,6 +2709,7 @@ static int __maybe_unused axienet_mcdma_probe(struct platform_device *pdev,
 		ret = kstrtou16(str, 16, &q->chan_id);
 		lp->qnum[i] = i;
 		lp->chan_num[i] = q->chan_id;
+		axienet_mcdma_chan_config(pdev, q, i);
 	}
 
 	np = of_parse_phandle(pdev->dev.of_node, "axistream-connected",
@@ -3503,6 +3599,9 @@ static int axienet_probe(struct platform_device *pdev)
 		goto err_disable_clk;
 	}
 	skb_queue_head_init(lp->granted_q);
+	spin_lock_init(&lp->counter_lock);
+	INIT_DELAYED_WORK(&lp->grant_work, axienet_counter_ack_timeout);
+	axienet_counter_coalesce_init(lp);
 
 	lp->grant_work_q = create_workqueue("counter_q");
 	if(!lp->grant_work_q)
@@ -3514,6 +3613,8 @@ static int axienet_probe(struct platform_device *pdev)
 	}
 	printk("Generic Netlink Family registered\n");
 
+	u25_ring_attach(lp);
+
 //	INIT_DELAYED_WORK(&lp->grant_work, efx_mae_stats_send);
 //	queue_delayed_work(lp->grant_work_q, &lp->grant_work, msecs_to_jiffies(120000));
 #endif
@@ -3543,12 +3644,15 @@ static int axienet_remove(struct platform_device *pdev)
 	struct axienet_local *lp = netdev_priv(ndev);
 	int i, ret;
 #ifndef XILINX_MAC_DEBUG
+	u25_ring_detach();
 	//Unregister the family
 	ret = u25_netlink_exit();
 	if(ret != 0) {
 		printk("Unregister family %i\n",ret);
 	}
 	printk("Generic Netlink Family unregistered.\n");
+	axienet_counter_coalesce_fini(lp);
+	cancel_delayed_work_sync(&lp->grant_work);
 	if(lp->granted_q) {
 		skb_queue_purge(lp->granted_q);
 		kfree(lp->granted_q);
@@ -3564,6 +3668,10 @@ static int axienet_remove(struct platform_device *pdev)
 	if (!lp->is_tsn || lp->temac_no == XAE_TEMAC1) {
 		for_each_rx_dma_queue(lp, i)
 			netif_napi_del(&lp->napi[i]);
+#ifdef CONFIG_AXIENET_HAS_MCDMA
+		for_each_tx_dma_queue(lp, i)
+			netif_napi_del(&lp->napi_tx[i]);
+#endif
 	}
 #ifdef CONFIG_XILINX_TSN_PTP
 	axienet_ptp_timer_remove(lp->timer_priv);
@@ -3617,7 +3725,35 @@ static struct platform_driver axienet_driver = {
 	},
 };
 
-module_platform_driver(axienet_driver);
+/* The eMCDI ring device outlives individual devices: agents may keep it
+ * open and mapped across a remove and re-probe.
+ */
+static int __init axienet_init(void)
+{
+	int ret;
+
+#ifndef XILINX_MAC_DEBUG
+	ret = u25_ring_init();
+	if (ret)
+		return ret;
+#endif
+	ret = platform_driver_register(&axienet_driver);
+#ifndef XILINX_MAC_DEBUG
+	if (ret)
+		u25_ring_exit();
+#endif
+	return ret;
+}
+module_init(axienet_init);
+
+static void __exit axienet_exit(void)
+{
+	platform_driver_unregister(&axienet_driver);
+#ifndef XILINX_MAC_DEBUG
+	u25_ring_exit();
+#endif
+}
+module_exit(axienet_exit);
 
 MODULE_DESCRIPTION("Xilinx Axi Ethernet driver");
 MODULE_AUTHOR("Xilinx");
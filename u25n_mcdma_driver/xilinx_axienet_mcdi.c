@@ -8,8 +8,9 @@
  */
 
 #include "xilinx_axienet_mcdi.h"
+#include "xilinx_axienet_ring.h"
 
-extern int pid[8], snd_seq;
+extern int snd_seq;
 extern struct sock *nl_sk;
 struct axienet_local *lp_g;
 EXPORT_SYMBOL(lp_g);
@@ -52,14 +53,14 @@ void pkt_hex_dump(struct sk_buff *skb)
 #endif
 }
 
-void *add_netlink_header(struct sk_buff *skb, uint8_t index)
+void *add_netlink_header(struct sk_buff *skb, u32 portid)
 {
         struct nlmsghdr *nlh;
         nlh = (struct nlmsghdr *)skb_push(skb , NLMSG_HDRLEN);
         nlh->nlmsg_type = NL_TYPE_CAM;
         nlh->nlmsg_len = skb->len;
         nlh->nlmsg_flags = 0;
-        nlh->nlmsg_pid = pid[index];
+        nlh->nlmsg_pid = portid;
         nlh->nlmsg_seq = 0;
 	
         return (char*) nlh;
@@ -67,21 +68,27 @@ void *add_netlink_header(struct sk_buff *skb, uint8_t index)
 
 void control_packet_handle(struct sk_buff *skb, uint8_t qid, uint8_t index)
 {
+	struct emcdi_ethhdr *hdr = (struct emcdi_ethhdr *)skb->data;
 	int  err;
         void *msg_head;
+	u32 portid;
 
 #if 0	
 	if(index == 5) {
-		int n;
-		n = sizeof(pid)/sizeof(pid[0]);
 		skb_push(skb , 1);
-		skb->data[0] = n-2;
+		skb->data[0] = U25_EMCDI_N_INDEX - 2;
 	}
 #endif
+	/* Agents that mapped a shared ring get requests there */
+	if (u25_ring_deliver(skb, qid, index))
+		return;
+
+	portid = u25_nl_pick_subscriber(index, ntohs(hdr->seq_num));
+
 	skb_push(skb , 1);
 	skb->data[0] = qid;
 
-	msg_head = add_netlink_header(skb, index);
+	msg_head = add_netlink_header(skb, portid);
         if (msg_head == NULL) {
                 pr_info("ERROR in adding netlink header\n");
                 err = -ENOMEM;
@@ -89,16 +96,19 @@ void control_packet_handle(struct sk_buff *skb, uint8_t qid, uint8_t index)
         }
  
         nlmsg_end(skb , msg_head);
-	if (pid[index] == 0) {
+	if (portid == 0) {
 		pr_info("ERR: Application not available!\n");
 		goto out;
 	} else {
 		rcu_read_lock();
-        	err = nlmsg_unicast(nl_sk, skb, pid[index]);
+        	err = nlmsg_unicast(nl_sk, skb, portid);
         	if (err != 0) {
         	        pr_info("ERR:nlmsg_unicast err: %d\n", err);
-        	}
+		}
 		rcu_read_unlock();
+		/* The agent died without closing its socket cleanly */
+		if (err == -ECONNREFUSED)
+			u25_nl_unsubscribe(index, portid);
 		return;
 	}
 out:
@@ -115,11 +125,237 @@ void ipsec_counter_ack_packet_handle(uint16_t seq_num, uint8_t *data)
 #endif
 }
 
-void axienet_counter_packet_handler(struct axienet_local *lp, struct sk_buff *skb)
+/* Called with lp->counter_lock held */
+static bool axienet_counter_has_credit(struct axienet_local *lp,
+				       struct sk_buff *skb)
+{
+	struct emcdi_ethhdr *hdr = (struct emcdi_ethhdr *)skb->data;
+
+	return !lp->counter_paced ||
+	       (s16)(ntohs(hdr->seq_num) - lp->counter_limit) < 0;
+}
+
+/* Send as many backlogged counter packets as the host has granted credits
+ * for.  Called with lp->counter_lock held.
+ */
+static void axienet_counter_flush(struct axienet_local *lp)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_peek(lp->granted_q)) &&
+	       axienet_counter_has_credit(lp, skb)) {
+		__skb_unlink(skb, lp->granted_q);
+		netif_tx_lock(lp->ndev);
+		lp->ndev->netdev_ops->ndo_start_xmit(skb, lp->ndev);
+		netif_tx_unlock(lp->ndev);
+		lp->counter_sent++;
+	}
+}
+
+void axienet_counter_ack_timeout(struct work_struct *work)
+{
+	struct axienet_local *lp = container_of(work, struct axienet_local,
+						grant_work.work);
+	unsigned long deadline;
+
+	spin_lock_bh(&lp->counter_lock);
+	if (skb_queue_empty(lp->granted_q))
+		goto out;
+	deadline = lp->counter_last_ack + U25_COUNTER_ACK_TIMEOUT;
+	if (time_before(jiffies, deadline)) {
+		queue_delayed_work(lp->grant_work_q, &lp->grant_work,
+				   deadline - jiffies);
+		goto out;
+	}
+	/* The host has stopped ACKing, e.g. its driver was reloaded.  Go back
+	 * to sending unpaced until it ACKs again.
+	 */
+	pr_info("%s: no counter ACK from host, sending unpaced\n", __func__);
+	lp->counter_paced = false;
+	lp->counter_ack_timeouts++;
+	axienet_counter_flush(lp);
+out:
+	spin_unlock_bh(&lp->counter_lock);
+}
+
+void counter_ack_packet_handle(struct axienet_local *lp, struct sk_buff *skb)
+{
+	struct emcdi_ethhdr *hdr = (struct emcdi_ethhdr *)skb->data;
+	u16 credits = U25_COUNTER_DEFAULT_CREDITS;
+	struct counter_ack *ack;
+	bool resync = false;
+	u16 limit;
+
+	if (skb->len >= sizeof(*hdr) + sizeof(*ack)) {
+		ack = (struct counter_ack *)(skb->data + sizeof(*hdr));
+		if (le16_to_cpu(ack->credits))
+			credits = le16_to_cpu(ack->credits);
+		resync = ack->flags & U25_COUNTER_ACK_FLAG_RESYNC;
+	}
+	limit = ntohs(hdr->seq_num) + 1 + credits;
+
+	spin_lock_bh(&lp->counter_lock);
+	/* ACKs may be reordered; never let a stale one shrink the window */
+	if (!lp->counter_paced || resync ||
+	    (s16)(limit - lp->counter_limit) > 0)
+		lp->counter_limit = limit;
+	lp->counter_paced = true;
+	lp->counter_last_ack = jiffies;
+	axienet_counter_flush(lp);
+	spin_unlock_bh(&lp->counter_lock);
+
+	dev_kfree_skb(skb);
+}
+
+static void axienet_counter_push_hdr(struct sk_buff *skb)
 {
         struct emcdi_ethhdr *emcdi_hdr;
         u8 emcdi_src_mac_addr[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
-	static int seqnum = 0;
+
+	emcdi_hdr = (struct emcdi_ethhdr *)skb_push(skb, sizeof(struct emcdi_ethhdr));
+	eth_broadcast_addr(emcdi_hdr->h_dest);
+	ether_addr_copy(emcdi_hdr->h_source, emcdi_src_mac_addr);
+	emcdi_hdr->h_inner_vlan_proto = htons(ETH_P_8021Q);
+	emcdi_hdr->h_inner_vlan_TCI = htons(U25_MPORT_TO_VLAN(U25_MPORT_ID_COUNTER));
+	emcdi_hdr->h_vlan_encapsulated_proto = htons(ETH_P_802_EX1);
+	emcdi_hdr->type = U25_EMCDI_TYPE_COUNTER;
+	emcdi_hdr->reserved = 0;
+}
+
+/* Counter packets are numbered as they are queued, so if the backlog
+ * overflows the host sees the gap in seq_num and accounts for the lost
+ * counts.  Called with lp->counter_lock held.
+ */
+static void axienet_counter_queue(struct axienet_local *lp, struct sk_buff *skb)
+{
+	struct emcdi_ethhdr *emcdi_hdr = (struct emcdi_ethhdr *)skb->data;
+
+	emcdi_hdr->seq_num = htons(lp->counter_seq++);
+	if (skb_queue_len(lp->granted_q) >= U25_COUNTER_BACKLOG_MAX) {
+		lp->counter_dropped++;
+		dev_kfree_skb_any(skb);
+		return;
+	}
+	__skb_queue_tail(lp->granted_q, skb);
+	axienet_counter_flush(lp);
+	if (!skb_queue_empty(lp->granted_q))
+		queue_delayed_work(lp->grant_work_q, &lp->grant_work,
+				   U25_COUNTER_ACK_TIMEOUT);
+}
+
+/* Send the packet being coalesced.  Called with lp->counter_lock held. */
+static void axienet_counter_agg_close(struct axienet_local *lp)
+{
+	struct sk_buff *skb = lp->counter_agg;
+	u8 *stats;
+
+	if (!skb)
+		return;
+	lp->counter_agg = NULL;
+	stats = skb->data + sizeof(struct emcdi_ethhdr);
+	*(__le16 *)(stats + 6) = cpu_to_le16(lp->counter_agg_n);
+	axienet_counter_queue(lp, skb);
+}
+
+static void axienet_counter_timer(struct timer_list *t)
+{
+	struct axienet_local *lp = from_timer(lp, t, counter_timer);
+
+	spin_lock_bh(&lp->counter_lock);
+	axienet_counter_agg_close(lp);
+	spin_unlock_bh(&lp->counter_lock);
+}
+
+/* Start a coalesced packet with the v2 header of @stats.  Called with
+ * lp->counter_lock held.
+ */
+static bool axienet_counter_agg_open(struct axienet_local *lp, const u8 *stats,
+				     u8 poff, u16 queue_mapping)
+{
+	struct sk_buff *skb;
+
+	skb = netdev_alloc_skb(lp->ndev, U25_COUNTER_AGG_MAX_LEN);
+	if (!skb)
+		return false;
+	skb_reserve(skb, sizeof(struct emcdi_ethhdr));
+	skb_put_data(skb, stats, poff);
+	axienet_counter_push_hdr(skb);
+	skb->queue_mapping = queue_mapping;
+
+	lp->counter_agg = skb;
+	lp->counter_agg_n = 0;
+	lp->counter_agg_poff = poff;
+	mod_timer(&lp->counter_timer,
+		  jiffies + usecs_to_jiffies(lp->counter_coalesce_usecs));
+	return true;
+}
+
+/**
+ * axienet_counter_coalesce - Merge a v2 counter packet into the next one out
+ * @lp:		Pointer to axienet local structure
+ * @skb:	Counter packet, starting at its MAE v2 header
+ *
+ * Counter updates are deltas, so entries can simply be concatenated; the
+ * host accumulates repeated indices.  Called with lp->counter_lock held.
+ *
+ * Return: false if @skb is not a v2 packet that can be merged.
+ */
+static bool axienet_counter_coalesce(struct axienet_local *lp,
+				     struct sk_buff *skb)
+{
+	const u8 *stats = skb->data;
+	unsigned int room, n;
+	u16 n_counters;
+	u8 poff;
+
+	if (!lp->counter_coalesce_usecs || skb->len < U25_COUNTER_V2_HDR_MIN ||
+	    stats[0] != U25_COUNTER_V2_VERSION ||
+	    stats[1] != U25_COUNTER_V2_IDENT_AR ||
+	    stats[2] != U25_COUNTER_V2_HEADER_OFFSET)
+		return false;
+	poff = stats[3];
+	n_counters = le16_to_cpu(*(__le16 *)(stats + 6));
+	if (poff < U25_COUNTER_V2_HDR_MIN ||
+	    poff + n_counters * U25_COUNTER_V2_ENTRY_LEN > skb->len)
+		return false;
+
+	if (lp->counter_agg && lp->counter_agg_poff != poff)
+		axienet_counter_agg_close(lp);
+
+	stats += poff;
+	while (n_counters) {
+		if (!lp->counter_agg &&
+		    !axienet_counter_agg_open(lp, skb->data, poff,
+					      skb->queue_mapping)) {
+			if (stats == skb->data + poff)
+				return false;
+			/* Part of @skb is already on its way */
+			lp->counter_dropped++;
+			break;
+		}
+		room = (U25_COUNTER_AGG_MAX_LEN - lp->counter_agg->len) /
+		       U25_COUNTER_V2_ENTRY_LEN;
+		if (lp->counter_coalesce_entries > lp->counter_agg_n)
+			room = min(room, lp->counter_coalesce_entries -
+					 lp->counter_agg_n);
+		else
+			room = 0;
+		n = min_t(unsigned int, room, n_counters);
+		skb_put_data(lp->counter_agg, stats,
+			     n * U25_COUNTER_V2_ENTRY_LEN);
+		lp->counter_agg_n += n;
+		stats += n * U25_COUNTER_V2_ENTRY_LEN;
+		n_counters -= n;
+		if (n == room)
+			axienet_counter_agg_close(lp);
+	}
+	lp->counter_coalesced++;
+	dev_kfree_skb_any(skb);
+	return true;
+}
+
+void axienet_counter_packet_handler(struct axienet_local *lp, struct sk_buff *skb)
+{
 	uint8_t *data;
 
 //	pkt_hex_dump(skb);
@@ -133,19 +369,14 @@ void axienet_counter_packet_handler(struct axienet_local *lp, struct sk_buff *sk
 
 		skb_pull(skb, 28);
 
-        	emcdi_hdr = (struct emcdi_ethhdr *)skb_push(skb, sizeof(struct emcdi_ethhdr));
-        	eth_broadcast_addr(emcdi_hdr->h_dest);
-        	ether_addr_copy(emcdi_hdr->h_source, emcdi_src_mac_addr);
-        	emcdi_hdr->h_inner_vlan_proto = htons(ETH_P_8021Q);
-        	emcdi_hdr->h_inner_vlan_TCI = htons(U25_MPORT_TO_VLAN(U25_MPORT_ID_COUNTER));
-        	emcdi_hdr->h_vlan_encapsulated_proto = htons(ETH_P_802_EX1);
-        	emcdi_hdr->type = U25_EMCDI_TYPE_COUNTER;
-        	emcdi_hdr->reserved = 0;
-        	emcdi_hdr->seq_num = htons(seqnum);
-        	seqnum++;
-		netif_tx_lock(lp_g->ndev);
-                lp_g->ndev->netdev_ops->ndo_start_xmit(skb, lp_g->ndev);
-                netif_tx_unlock(lp_g->ndev);
+		spin_lock_bh(&lp->counter_lock);
+		if (!axienet_counter_coalesce(lp, skb)) {
+			/* Keep the stream in order */
+			axienet_counter_agg_close(lp);
+			axienet_counter_push_hdr(skb);
+			axienet_counter_queue(lp, skb);
+		}
+		spin_unlock_bh(&lp->counter_lock);
 
 	} else 
 		dev_kfree_skb(skb);
@@ -153,6 +384,38 @@ void axienet_counter_packet_handler(struct axienet_local *lp, struct sk_buff *sk
 	return;
 }
 
+void axienet_counter_coalesce_init(struct axienet_local *lp)
+{
+	lp->counter_coalesce_usecs = U25_COUNTER_COALESCE_USECS;
+	lp->counter_coalesce_entries = (U25_COUNTER_AGG_MAX_LEN -
+					sizeof(struct emcdi_ethhdr) -
+					U25_COUNTER_V2_HDR_MIN) /
+				       U25_COUNTER_V2_ENTRY_LEN;
+	timer_setup(&lp->counter_timer, axienet_counter_timer, 0);
+}
+
+void axienet_counter_coalesce_fini(struct axienet_local *lp)
+{
+	del_timer_sync(&lp->counter_timer);
+	spin_lock_bh(&lp->counter_lock);
+	dev_kfree_skb_any(lp->counter_agg);
+	lp->counter_agg = NULL;
+	spin_unlock_bh(&lp->counter_lock);
+}
+
+/* Agent serving each eMCDI type received on the control m-port, or -1 */
+static const s8 u25_emcdi_control_index[U25_EMCDI_N_TYPES] = {
+	[0 ... U25_EMCDI_N_TYPES - 1]	= -1,
+	[U25_EMCDI_TYPE_CONTROL]	= U25_EMCDI_TYPE_CONTROL_INDEX,
+	[U25_EMCDI_TYPE_IPSEC]		= U25_EMCDI_TYPE_IPSEC_INDEX,
+	[U25_EMCDI_TYPE_FIREWALL]	= U25_EMCDI_TYPE_FIREWALL_INDEX,
+	[U25_EMCDI_TYPE_IMG]		= U25_EMCDI_TYPE_IMG_INDEX,
+	[U25_EMCDI_TYPE_CONTROLLER]	= U25_EMCDI_TYPE_CONTROLLER_INDEX,
+	[U25_EMCDI_TYPE_QOS_HTB_CONFIG]	= U25_EMCDI_TYPE_QOS_HTB_CONFIG_INDEX,
+	[U25_EMCDI_TYPE_LOGS]		= U25_EMCDI_TYPE_LOGS_INDEX,
+	[U25_EMCDI_TYPE_FLASH_UPGRADE]	= U25_EMCDI_TYPE_FLASH_UPGRADE_INDEX,
+};
+
 int axienet_emcdi_packet_handler(struct axienet_local *lp, struct sk_buff *skb, uint8_t qid)
 {
 	uint8_t type;
@@ -176,36 +439,27 @@ int axienet_emcdi_packet_handler(struct axienet_local *lp, struct sk_buff *skb,
 	}
 	
 	if (inner_mport == U25_MPORT_ID_CONTROL) {
+		if (type >= U25_EMCDI_N_TYPES ||
+		    u25_emcdi_control_index[type] < 0) {
+			pr_info("%s:Mismatch in control packet type\n",__func__);
+			return -EIO;
+		}
+		if (type == U25_EMCDI_TYPE_LOGS)
+			snd_que = qid - 1;
+		control_packet_handle(skb, qid - 1,
+				      u25_emcdi_control_index[type]);
+	} else if (inner_mport == U25_MPORT_ID_COUNTER) {
         switch (type) {
-            case U25_EMCDI_TYPE_CONTROL:
-                control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_CONTROL_INDEX);
-                break;
-            case U25_EMCDI_TYPE_IPSEC:
-                control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_IPSEC_INDEX);
-                break;
-            case U25_EMCDI_TYPE_FIREWALL:
-                control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_FIREWALL_INDEX);
-                break;
-	    case U25_EMCDI_TYPE_IMG:
-		control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_IMG_INDEX);
-		break;
-	    case U25_EMCDI_TYPE_CONTROLLER:
-                control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_CONTROLLER_INDEX);
-                break;
-#if 1
-            case U25_EMCDI_TYPE_QOS_HTB_CONFIG:
-                control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_QOS_HTB_CONFIG_INDEX);
+            case U25_EMCDI_TYPE_COUNTER_ACK:
+                counter_ack_packet_handle(lp, skb);
                 break;
-	    case U25_EMCDI_TYPE_LOGS:
-		snd_que = qid-1;
-		control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_LOGS_INDEX);
-                break;
-#endif
-	    case U25_EMCDI_TYPE_FLASH_UPGRADE:
-                control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_FLASH_UPGRADE_INDEX);
+            case U25_EMCDI_TYPE_IPSEC_COUNTER_ACK:
+                ipsec_counter_ack_packet_handle(ntohs(hdr->seq_num),
+                                                skb->data + sizeof(*hdr));
+                dev_kfree_skb(skb);
                 break;
             default:
-                pr_info("%s:Mismatch in control packet type\n",__func__);
+                pr_info("%s:Mismatch in counter packet type\n",__func__);
                 return -EIO;
         }
 	} else {
@@ -216,3 +470,23 @@ int axienet_emcdi_packet_handler(struct axienet_local *lp, struct sk_buff *skb,
 	return 0;
 }
 
+/* Handler for channels with AXIENET_CHAN_ROLE_LOGS: only logger requests on
+ * the control m-port are accepted, and replies go back on the same channel.
+ */
+int axienet_emcdi_logs_handler(struct axienet_local *lp, struct sk_buff *skb, uint8_t qid)
+{
+	struct emcdi_ethhdr *hdr = (struct emcdi_ethhdr *)skb->data;
+
+	lp_g = lp;
+	if (skb->len < sizeof(*hdr) ||
+	    hdr->h_inner_vlan_proto != htons(ETH_P_8021Q) ||
+	    hdr->h_vlan_encapsulated_proto != htons(ETH_P_802_EX1) ||
+	    U25_VLAN_TO_MPORT(ntohs(hdr->h_inner_vlan_TCI)) != U25_MPORT_ID_CONTROL ||
+	    hdr->type != U25_EMCDI_TYPE_LOGS)
+		return -EIO;
+
+	snd_que = qid - 1;
+	control_packet_handle(skb, qid - 1, U25_EMCDI_TYPE_LOGS_INDEX);
+	return 0;
+}
+
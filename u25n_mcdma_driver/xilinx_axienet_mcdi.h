@@ -16,6 +16,7 @@
 #define U25_EMCDI_TYPE_COUNTER_ACK      	2
 #define U25_EMCDI_TYPE_IPSEC            	3
 #define U25_EMCDI_TYPE_FIREWALL         	4
+#define U25_EMCDI_TYPE_IPSEC_COUNTER_ACK	7
 
 #define U25_EMCDI_TYPE_IMG 			8
 #define U25_EMCDI_TYPE_CONTROLLER       	6
@@ -32,12 +33,47 @@
 #define U25_EMCDI_TYPE_IMG_INDEX	   	7
 #define U25_EMCDI_TYPE_CONTROLLER_INDEX    	6
 #define U25_EMCDI_TYPE_FLASH_UPGRADE_INDEX 	5
+#define U25_EMCDI_N_INDEX			8
+
+#define U25_EMCDI_N_TYPES			16
 
 #define U25_MPORT_ID_COUNTER            	0xFD
 #define U25_MPORT_ID_CONTROL            	0xFE
 #define U25_MPORT_TO_VLAN(mport)        	mport ^ 0x800
 #define U25_VLAN_TO_MPORT(vlan)         	vlan ^ 0x800
 
+/* Counter stream flow control.  The host ACKs counter packets by seq_num
+ * and grants credits to send that many more; until the first ACK (or if
+ * ACKs stop for U25_COUNTER_ACK_TIMEOUT) counter packets are sent unpaced,
+ * so an older host driver that never ACKs keeps working.
+ */
+#define U25_COUNTER_DEFAULT_CREDITS		32
+#define U25_COUNTER_BACKLOG_MAX			256
+#define U25_COUNTER_ACK_TIMEOUT			(HZ / 10)
+
+/* Payload of a U25_EMCDI_TYPE_COUNTER_ACK packet */
+struct counter_ack {
+	__u8            status;
+	__u8            flags;
+	__le16          credits;
+} __attribute__((packed));
+
+#define U25_COUNTER_ACK_FLAG_RESYNC		0x01
+
+/* Counter coalescing.  MAE v2 counter packets (see mae_counter_format.h in
+ * the host driver) are merged into one packet per U25_COUNTER_AGG_MAX_LEN
+ * or per coalescing window, whichever fills first.  The hardware adds an
+ * outer VLAN tag on the way to the host, which must still fit a standard
+ * host RX buffer.
+ */
+#define U25_COUNTER_V2_VERSION			2
+#define U25_COUNTER_V2_IDENT_AR			0
+#define U25_COUNTER_V2_HEADER_OFFSET		4
+#define U25_COUNTER_V2_HDR_MIN			8
+#define U25_COUNTER_V2_ENTRY_LEN		16
+#define U25_COUNTER_AGG_MAX_LEN			(ETH_FRAME_LEN - VLAN_HLEN)
+#define U25_COUNTER_COALESCE_USECS		1000
+
 
 struct emcdi_ethhdr {
         unsigned char   h_dest[ETH_ALEN];
@@ -66,8 +102,12 @@ struct counter {
 };
 void control_packet_handle(struct sk_buff *skb, uint8_t qid, uint8_t index);
 int axienet_emcdi_packet_handler(struct axienet_local *lp , struct sk_buff *skb, uint8_t qid);
-void counter_ack_packet_handle(uint8_t seq_num);
+int axienet_emcdi_logs_handler(struct axienet_local *lp, struct sk_buff *skb, uint8_t qid);
+void counter_ack_packet_handle(struct axienet_local *lp, struct sk_buff *skb);
 void axienet_counter_packet_handler(struct axienet_local *lp, struct sk_buff *skb);
+void axienet_counter_ack_timeout(struct work_struct *work);
+void axienet_counter_coalesce_init(struct axienet_local *lp);
+void axienet_counter_coalesce_fini(struct axienet_local *lp);
 
 #endif /* XILINX_MCDI_H */
 
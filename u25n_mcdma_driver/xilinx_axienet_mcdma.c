@@ -19,6 +19,8 @@
 #include <linux/of_irq.h>
 #include <linux/of_address.h>
 #include <linux/of_net.h>
+#include <linux/interrupt.h>
+#include <linux/rtnetlink.h>
 
 #include "xilinx_axienet.h"
 
@@ -96,6 +98,16 @@ static struct axienet_stat axienet_get_rx_strings_stats[] = {
 	{ "rxq15_bytes"   },
 };
 
+#ifndef XILINX_MAC_DEBUG
+static struct axienet_stat axienet_get_counter_strings_stats[] = {
+	{ "counter_sent" },
+	{ "counter_dropped" },
+	{ "counter_backlog" },
+	{ "counter_ack_timeouts" },
+	{ "counter_coalesced" },
+};
+#endif
+
 /**
  * axienet_mcdma_tx_bd_free - Release MCDMA Tx buffer descriptor rings
  * @ndev:	Pointer to the net_device structure
@@ -123,6 +135,121 @@ void __maybe_unused axienet_mcdma_tx_bd_free(struct net_device *ndev,
 	}
 }
 
+/* Frames, with headroom and skb_shared_info, must fit in half a page for
+ * the RX page recycling scheme; otherwise (jumbo) fall back to skbs.
+ */
+static bool axienet_rx_page_mode(struct axienet_local *lp)
+{
+	return SKB_DATA_ALIGN(AXIENET_RX_HEADROOM + lp->max_frm_size) +
+	       SKB_DATA_ALIGN(sizeof(struct skb_shared_info)) <=
+	       AXIENET_RX_BUF_TRUESIZE;
+}
+
+static int axienet_rx_page_alloc(struct net_device *ndev,
+				 struct axienet_rx_page *rp)
+{
+	struct page *page;
+	dma_addr_t dma;
+
+	page = dev_alloc_page();
+	if (!page)
+		return -ENOMEM;
+	dma = dma_map_page_attrs(ndev->dev.parent, page, 0, PAGE_SIZE,
+				 DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+	if (dma_mapping_error(ndev->dev.parent, dma)) {
+		__free_page(page);
+		return -ENOMEM;
+	}
+	rp->page = page;
+	rp->dma = dma;
+	rp->offset = 0;
+	return 0;
+}
+
+static void axienet_rx_page_free(struct net_device *ndev,
+				 struct axienet_rx_page *rp)
+{
+	if (!rp->page)
+		return;
+	dma_unmap_page_attrs(ndev->dev.parent, rp->dma, PAGE_SIZE,
+			     DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+	put_page(rp->page);
+	rp->page = NULL;
+}
+
+/**
+ * axienet_mcdma_rx_page_refill - Give the current RX page half back to a BD
+ * @ndev:	Pointer to the net_device structure
+ * @q:		Pointer to DMA queue structure
+ * @cur_p:	The BD at q->rx_bd_ci
+ */
+void axienet_mcdma_rx_page_refill(struct net_device *ndev,
+				  struct axienet_dma_q *q,
+				  struct aximcdma_bd *cur_p)
+{
+	struct axienet_local *lp = netdev_priv(ndev);
+	struct axienet_rx_page *rp = &q->rx_pages[q->rx_bd_ci];
+
+	dma_sync_single_range_for_device(ndev->dev.parent, rp->dma,
+					 rp->offset + AXIENET_RX_HEADROOM,
+					 lp->max_frm_size, DMA_FROM_DEVICE);
+	cur_p->phys = rp->dma + rp->offset + AXIENET_RX_HEADROOM;
+	cur_p->cntrl = lp->max_frm_size;
+	cur_p->sw_id_offset = 0;
+}
+
+/**
+ * axienet_mcdma_rx_page_skb - Build an skb around a completed RX buffer
+ * @ndev:	Pointer to the net_device structure
+ * @q:		Pointer to DMA queue structure
+ * @length:	Length of the received frame
+ *
+ * The buffer at q->rx_bd_ci is handed to the skb.  If the stack has already
+ * released the other half of its page, the BD flips to that half and the
+ * page is reused without being remapped; otherwise a new page is mapped.
+ *
+ * Return: the skb, or NULL if no memory, in which case the BD is untouched.
+ */
+struct sk_buff *axienet_mcdma_rx_page_skb(struct net_device *ndev,
+					  struct axienet_dma_q *q,
+					  u32 length)
+{
+	struct axienet_rx_page *rp = &q->rx_pages[q->rx_bd_ci];
+	struct axienet_rx_page new_rp = {};
+	struct sk_buff *skb;
+	bool reuse;
+
+	reuse = page_ref_count(rp->page) == 1 &&
+		!page_is_pfmemalloc(rp->page);
+	if (!reuse && axienet_rx_page_alloc(ndev, &new_rp))
+		return NULL;
+
+	dma_sync_single_range_for_cpu(ndev->dev.parent, rp->dma,
+				      rp->offset + AXIENET_RX_HEADROOM,
+				      length, DMA_FROM_DEVICE);
+	skb = build_skb(page_address(rp->page) + rp->offset,
+			AXIENET_RX_BUF_TRUESIZE);
+	if (!skb) {
+		axienet_rx_page_free(ndev, &new_rp);
+		return NULL;
+	}
+	skb_reserve(skb, AXIENET_RX_HEADROOM);
+
+	if (reuse) {
+		/* The skb takes a reference; we keep ours */
+		page_ref_inc(rp->page);
+		rp->offset ^= AXIENET_RX_BUF_TRUESIZE;
+		q->rx_page_reuse++;
+	} else {
+		/* Our reference goes to the skb */
+		dma_unmap_page_attrs(ndev->dev.parent, rp->dma, PAGE_SIZE,
+				     DMA_FROM_DEVICE, DMA_ATTR_SKIP_CPU_SYNC);
+		*rp = new_rp;
+		q->rx_page_alloc++;
+	}
+	return skb;
+}
+
 /**
  * axienet_mcdma_rx_bd_free - Release MCDMA Rx buffer descriptor rings
  * @ndev:	Pointer to the net_device structure
@@ -137,11 +264,18 @@ void __maybe_unused axienet_mcdma_rx_bd_free(struct net_device *ndev,
 	int i;
 	struct axienet_local *lp = netdev_priv(ndev);
 
-	for (i = 0; i < lp->rx_bd_num; i++) {
-		dma_unmap_single(ndev->dev.parent, q->rxq_bd_v[i].phys,
-				 lp->max_frm_size, DMA_FROM_DEVICE);
-		dev_kfree_skb((struct sk_buff *)
-			      (q->rxq_bd_v[i].sw_id_offset));
+	if (q->rx_pages) {
+		for (i = 0; i < lp->rx_bd_num; i++)
+			axienet_rx_page_free(ndev, &q->rx_pages[i]);
+		kfree(q->rx_pages);
+		q->rx_pages = NULL;
+	} else {
+		for (i = 0; i < lp->rx_bd_num; i++) {
+			dma_unmap_single(ndev->dev.parent, q->rxq_bd_v[i].phys,
+					 lp->max_frm_size, DMA_FROM_DEVICE);
+			dev_kfree_skb((struct sk_buff *)
+				      (q->rxq_bd_v[i].sw_id_offset));
+		}
 	}
 
 	if (q->rxq_bd_v) {
@@ -260,11 +394,29 @@ int __maybe_unused axienet_mcdma_rx_q_init(struct net_device *ndev,
 	if (!q->rxq_bd_v)
 		goto out;
 
+	q->rx_page_reuse = 0;
+	q->rx_page_alloc = 0;
+	if (axienet_rx_page_mode(lp)) {
+		q->rx_pages = kcalloc(lp->rx_bd_num, sizeof(*q->rx_pages),
+				      GFP_KERNEL);
+		if (!q->rx_pages)
+			goto out;
+	}
+
 	for (i = 0; i < lp->rx_bd_num; i++) {
 		q->rxq_bd_v[i].next = q->rx_bd_p +
 				      sizeof(*q->rxq_bd_v) *
 				      ((i + 1) % lp->rx_bd_num);
 
+		if (q->rx_pages) {
+			if (axienet_rx_page_alloc(ndev, &q->rx_pages[i]))
+				goto out;
+			q->rxq_bd_v[i].phys = q->rx_pages[i].dma +
+					      AXIENET_RX_HEADROOM;
+			q->rxq_bd_v[i].cntrl = lp->max_frm_size;
+			continue;
+		}
+
 		skb = netdev_alloc_skb(ndev, lp->max_frm_size);
 		if (!skb)
 			goto out;
@@ -384,7 +536,11 @@ irqreturn_t __maybe_unused axienet_mcdma_tx_irq(int irq, void *_ndev)
 	status = axienet_dma_in32(q, XMCDMA_CHAN_SR_OFFSET(q->chan_id));
 	if (status & (XMCDMA_IRQ_IOC_MASK | XMCDMA_IRQ_DELAY_MASK)) {
 		axienet_dma_out32(q, XMCDMA_CHAN_SR_OFFSET(q->chan_id), status);
-		axienet_start_xmit_done(lp->ndev, q);
+		/* Reclaim in NAPI context; it re-enables the interrupts */
+		cr = axienet_dma_in32(q, XMCDMA_CHAN_CR_OFFSET(q->chan_id));
+		cr &= ~(XMCDMA_IRQ_IOC_MASK | XMCDMA_IRQ_DELAY_MASK);
+		axienet_dma_out32(q, XMCDMA_CHAN_CR_OFFSET(q->chan_id), cr);
+		napi_schedule(&lp->napi_tx[i]);
 		goto out;
 	}
 	if (!(status & XMCDMA_IRQ_ALL_MASK))
@@ -529,6 +685,13 @@ void axienet_strings(struct net_device *ndev, u32 sset, u8 *data)
 		if (i % 2 == 0)
 			++j;
 	}
+#ifndef XILINX_MAC_DEBUG
+	if (sset == ETH_SS_STATS)
+		for (k = 0; k < AXIENET_COUNTER_SSTATS_LEN; k++, i++)
+			memcpy(data + i * ETH_GSTRING_LEN,
+			       axienet_get_counter_strings_stats[k].name,
+			       ETH_GSTRING_LEN);
+#endif
 }
 
 int axienet_sset_count(struct net_device *ndev, int sset)
@@ -537,7 +700,8 @@ int axienet_sset_count(struct net_device *ndev, int sset)
 
 	switch (sset) {
 	case ETH_SS_STATS:
-		return (AXIENET_TX_SSTATS_LEN(lp) + AXIENET_RX_SSTATS_LEN(lp));
+		return (AXIENET_TX_SSTATS_LEN(lp) + AXIENET_RX_SSTATS_LEN(lp) +
+			AXIENET_COUNTER_SSTATS_LEN);
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -570,6 +734,15 @@ void axienet_get_stats(struct net_device *ndev,
 		data[i++] = q->rx_bytes;
 		++j;
 	}
+#ifndef XILINX_MAC_DEBUG
+	spin_lock_bh(&lp->counter_lock);
+	data[i++] = lp->counter_sent;
+	data[i++] = lp->counter_dropped;
+	data[i++] = skb_queue_len(lp->granted_q);
+	data[i++] = lp->counter_ack_timeouts;
+	data[i++] = lp->counter_coalesced;
+	spin_unlock_bh(&lp->counter_lock);
+#endif
 }
 
 /**
@@ -758,6 +931,8 @@ int __maybe_unused axienet_mcdma_tx_probe(struct platform_device *pdev,
 		q->eth_hasdre = of_property_read_bool(np,
 						      "xlnx,include-dre");
 		spin_lock_init(&q->tx_lock);
+		netif_tx_napi_add(lp->ndev, &lp->napi_tx[i],
+				  axienet_mcdma_tx_poll, XAXIENET_NAPI_WEIGHT);
 	}
 	of_node_put(np);
 
@@ -1008,7 +1183,247 @@ static ssize_t chan_weight_store(struct device *dev,
 	return count;
 }
 
+static const char *const axienet_chan_role_names[AXIENET_CHAN_ROLE_MAX] = {
+	[AXIENET_CHAN_ROLE_DATA]	= "data",
+	[AXIENET_CHAN_ROLE_CONTROL]	= "control",
+	[AXIENET_CHAN_ROLE_COUNTER]	= "counter",
+	[AXIENET_CHAN_ROLE_LOGS]	= "logs",
+};
+
+/**
+ * axienet_mcdma_chan_config - Set up the role and CPU of an MCDMA channel
+ * @pdev:	Pointer to platform device structure
+ * @q:		Pointer to DMA queue structure
+ * @i:		Index of @q, as for "xlnx,channel-ids"
+ *
+ * Reads "xlnx,channel-roles" and "xlnx,channel-cpus" if present.  Without
+ * them the counter channel is pinned to the last online CPU, away from the
+ * control channels, and all other channels carry eMCDI control traffic.
+ */
+void axienet_mcdma_chan_config(struct platform_device *pdev,
+			       struct axienet_dma_q *q, int i)
+{
+	struct device_node *node = pdev->dev.of_node;
+	const char *str;
+	u32 cpu;
+	int ret;
+
+	if (q->chan_id == AXIENET_COUNTER_CHAN_ID)
+		q->role = AXIENET_CHAN_ROLE_COUNTER;
+	else
+		q->role = AXIENET_CHAN_ROLE_CONTROL;
+	if (!of_property_read_string_index(node, "xlnx,channel-roles", i,
+					   &str)) {
+		ret = match_string(axienet_chan_role_names,
+				   AXIENET_CHAN_ROLE_MAX, str);
+		if (ret >= 0)
+			q->role = ret;
+		else
+			dev_warn(&pdev->dev, "unknown role %s for channel %u\n",
+				 str, q->chan_id);
+	}
+
+	q->cpu = -1;
+	if (!of_property_read_u32_index(node, "xlnx,channel-cpus", i, &cpu))
+		q->cpu = cpu < nr_cpu_ids ? cpu : -1;
+	else if (q->role == AXIENET_CHAN_ROLE_COUNTER && num_online_cpus() > 1)
+		q->cpu = cpumask_last(cpu_online_mask);
+}
+
+/**
+ * axienet_mcdma_set_affinity - Pin one of a channel's IRQs to its CPU
+ * @q:		Pointer to DMA queue structure
+ * @irq:	q->rx_irq or q->tx_irq, already requested
+ *
+ * NAPI runs where the IRQ is taken, so this also pins the channel's polling.
+ */
+void axienet_mcdma_set_affinity(struct axienet_dma_q *q, int irq)
+{
+	int cpu = READ_ONCE(q->cpu);
+
+	irq_set_affinity_hint(irq, cpu >= 0 && cpu_online(cpu) ?
+			      cpumask_of(cpu) : NULL);
+}
+
+static ssize_t chan_role_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	struct axienet_dma_q *q;
+	ssize_t len = 0;
+	int i;
+
+	for_each_rx_dma_queue(lp, i) {
+		q = lp->dq[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "q%d chan %u role %s cpu %d\n", i, q->chan_id,
+				 axienet_chan_role_names[q->role], q->cpu);
+	}
+	return len;
+}
+
+/* Accepts "<queue> <role>" */
+static ssize_t chan_role_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	char role[16];
+	int i, ret;
+
+	if (sscanf(buf, "%d %15s", &i, role) != 2)
+		return -EINVAL;
+	if (i < 0 || i >= lp->num_rx_queues)
+		return -EINVAL;
+	ret = match_string(axienet_chan_role_names, AXIENET_CHAN_ROLE_MAX,
+			   role);
+	if (ret < 0)
+		return ret;
+
+	WRITE_ONCE(lp->dq[i]->role, ret);
+	return count;
+}
+
+static ssize_t chan_cpu_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	struct axienet_dma_q *q;
+	ssize_t len = 0;
+	int i;
+
+	for_each_rx_dma_queue(lp, i) {
+		q = lp->dq[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "q%d chan %u cpu %d\n", i, q->chan_id,
+				 READ_ONCE(q->cpu));
+	}
+	return len;
+}
+
+/* Accepts "<queue> <cpu>", or "<queue> -1" to unpin */
+static ssize_t chan_cpu_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	struct axienet_dma_q *q;
+	int i, cpu;
+
+	if (sscanf(buf, "%d %d", &i, &cpu) != 2)
+		return -EINVAL;
+	if (i < 0 || i >= lp->num_rx_queues)
+		return -EINVAL;
+	if (cpu < -1 || (cpu >= 0 && !cpu_online(cpu)))
+		return -EINVAL;
+	q = lp->dq[i];
+
+	rtnl_lock();
+	WRITE_ONCE(q->cpu, cpu);
+	/* Otherwise applied by axienet_open() */
+	if (netif_running(ndev)) {
+		axienet_mcdma_set_affinity(q, q->rx_irq);
+		if (i < lp->num_tx_queues)
+			axienet_mcdma_set_affinity(q, q->tx_irq);
+	}
+	rtnl_unlock();
+	return count;
+}
+
+/* How RX buffers were refilled on each queue since it was started */
+static ssize_t rx_page_stats_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	struct axienet_dma_q *q;
+	ssize_t len = 0;
+	int i;
+
+	for_each_rx_dma_queue(lp, i) {
+		q = lp->dq[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "q%d chan %u reuse %lu alloc %lu\n", i,
+				 q->chan_id, READ_ONCE(q->rx_page_reuse),
+				 READ_ONCE(q->rx_page_alloc));
+	}
+	return len;
+}
+
+#ifndef XILINX_MAC_DEBUG
+static ssize_t counter_coalesce_usecs_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+
+	return sprintf(buf, "%u\n", lp->counter_coalesce_usecs);
+}
+
+/* 0 forwards every counter packet as it arrives */
+static ssize_t counter_coalesce_usecs_store(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	spin_lock_bh(&lp->counter_lock);
+	lp->counter_coalesce_usecs = val;
+	spin_unlock_bh(&lp->counter_lock);
+	return count;
+}
+
+static ssize_t counter_coalesce_entries_show(struct device *dev,
+					     struct device_attribute *attr,
+					     char *buf)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+
+	return sprintf(buf, "%u\n", lp->counter_coalesce_entries);
+}
+
+/* Counter entries per coalesced packet; at most what fits in one frame */
+static ssize_t counter_coalesce_entries_store(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct net_device *ndev = dev_get_drvdata(dev);
+	struct axienet_local *lp = netdev_priv(ndev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (!val)
+		return -EINVAL;
+
+	spin_lock_bh(&lp->counter_lock);
+	lp->counter_coalesce_entries = val;
+	spin_unlock_bh(&lp->counter_lock);
+	return count;
+}
+
+static DEVICE_ATTR_RW(counter_coalesce_usecs);
+static DEVICE_ATTR_RW(counter_coalesce_entries);
+#endif
 static DEVICE_ATTR_RW(chan_weight);
+static DEVICE_ATTR_RW(chan_role);
+static DEVICE_ATTR_RW(chan_cpu);
+static DEVICE_ATTR_RO(rx_page_stats);
 static DEVICE_ATTR_RO(rxch_obs1);
 static DEVICE_ATTR_RO(rxch_obs2);
 static DEVICE_ATTR_RO(rxch_obs3);
@@ -1023,6 +1438,13 @@ static DEVICE_ATTR_RO(txch_obs5);
 static DEVICE_ATTR_RO(txch_obs6);
 static const struct attribute *mcdma_attrs[] = {
 	&dev_attr_chan_weight.attr,
+	&dev_attr_chan_role.attr,
+	&dev_attr_chan_cpu.attr,
+	&dev_attr_rx_page_stats.attr,
+#ifndef XILINX_MAC_DEBUG
+	&dev_attr_counter_coalesce_usecs.attr,
+	&dev_attr_counter_coalesce_entries.attr,
+#endif
 	&dev_attr_rxch_obs1.attr,
 	&dev_attr_rxch_obs2.attr,
 	&dev_attr_rxch_obs3.attr,
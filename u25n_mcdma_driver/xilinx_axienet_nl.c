@@ -17,8 +17,132 @@ EXPORT_SYMBOL(nl_sk);
 extern struct axienet_local *lp_g;
 /* Attribute validation policy */
 extern int snd_que;
-int pid[8]; 
-EXPORT_SYMBOL(pid);
+
+/**
+ * struct u25_nl_type - Netlink subscribers of one eMCDI type
+ * @name:	Name agents register with in an NL_TYPE_PID message
+ * @n_pids:	Number of valid entries in @pids
+ * @pids:	Netlink port ids of the subscribed agents
+ */
+struct u25_nl_type {
+	const char *name;
+	unsigned int n_pids;
+	u32 pids[U25_NL_MAX_SUBSCRIBERS];
+};
+
+static struct u25_nl_type u25_nl_types[U25_EMCDI_N_INDEX] = {
+	[U25_EMCDI_TYPE_CONTROL_INDEX]		= { .name = "MAE" },
+	[U25_EMCDI_TYPE_IPSEC_INDEX]		= { .name = "IPSEC" },
+	[U25_EMCDI_TYPE_FIREWALL_INDEX]		= { .name = "FIREWALL" },
+	[U25_EMCDI_TYPE_QOS_HTB_CONFIG_INDEX]	= { .name = "QOS_HTB_CONFIG" },
+	[U25_EMCDI_TYPE_LOGS_INDEX]		= { .name = "LOGS" },
+	[U25_EMCDI_TYPE_FLASH_UPGRADE_INDEX]	= { .name = "FLASH UPGRADE" },
+	[U25_EMCDI_TYPE_CONTROLLER_INDEX]	= { .name = "CONTROLLER" },
+	[U25_EMCDI_TYPE_IMG_INDEX]		= { .name = "IMAGE UPGRADE" },
+};
+/* Protects u25_nl_types[].n_pids and .pids */
+static DEFINE_SPINLOCK(u25_nl_lock);
+
+static int u25_nl_type_index(const char *name, int len)
+{
+	int i;
+
+	if (len <= 0)
+		return -1;
+	for (i = 0; i < U25_EMCDI_N_INDEX; i++)
+		if (u25_nl_types[i].name &&
+		    !strncmp(name, u25_nl_types[i].name, len) &&
+		    strnlen(name, len) == strlen(u25_nl_types[i].name))
+			return i;
+	return -1;
+}
+
+static int u25_nl_subscribe(int index, u32 portid)
+{
+	struct u25_nl_type *t = &u25_nl_types[index];
+	int rc = 0, i;
+
+	spin_lock_bh(&u25_nl_lock);
+	for (i = 0; i < t->n_pids; i++)
+		if (t->pids[i] == portid)
+			goto out;
+	if (t->n_pids == U25_NL_MAX_SUBSCRIBERS) {
+		rc = -ENOSPC;
+		goto out;
+	}
+	t->pids[t->n_pids++] = portid;
+out:
+	spin_unlock_bh(&u25_nl_lock);
+	return rc;
+}
+
+/* Called with u25_nl_lock held */
+static void __u25_nl_unsubscribe(struct u25_nl_type *t, u32 portid)
+{
+	int i;
+
+	for (i = 0; i < t->n_pids; i++)
+		if (t->pids[i] == portid) {
+			t->pids[i] = t->pids[--t->n_pids];
+			return;
+		}
+}
+
+/**
+ * u25_nl_unsubscribe - Remove an agent from the subscribers of a type
+ * @index:	U25_EMCDI_TYPE_*_INDEX
+ * @portid:	Netlink port id of the agent
+ *
+ * Also used from the receive path when a unicast finds the agent gone.
+ */
+void u25_nl_unsubscribe(int index, u32 portid)
+{
+	spin_lock_bh(&u25_nl_lock);
+	__u25_nl_unsubscribe(&u25_nl_types[index], portid);
+	spin_unlock_bh(&u25_nl_lock);
+}
+
+/**
+ * u25_nl_pick_subscriber - Choose the agent to handle a request
+ * @index:	U25_EMCDI_TYPE_*_INDEX
+ * @seq:	eMCDI sequence number of the request
+ *
+ * Requests are spread over the subscribers of a type by sequence number.
+ *
+ * Return: netlink port id of the agent, or 0 if there is none.
+ */
+u32 u25_nl_pick_subscriber(int index, u16 seq)
+{
+	struct u25_nl_type *t = &u25_nl_types[index];
+	u32 portid = 0;
+
+	spin_lock_bh(&u25_nl_lock);
+	if (t->n_pids)
+		portid = t->pids[seq % t->n_pids];
+	spin_unlock_bh(&u25_nl_lock);
+	return portid;
+}
+
+/* Drop every subscription of a netlink socket when it is closed */
+static int u25_nl_notify(struct notifier_block *nb, unsigned long event,
+			 void *ptr)
+{
+	struct netlink_notify *n = ptr;
+	int i;
+
+	if (event != NETLINK_URELEASE || n->protocol != NETLINK_USER)
+		return NOTIFY_DONE;
+
+	spin_lock_bh(&u25_nl_lock);
+	for (i = 0; i < U25_EMCDI_N_INDEX; i++)
+		__u25_nl_unsubscribe(&u25_nl_types[i], n->portid);
+	spin_unlock_bh(&u25_nl_lock);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block u25_nl_notifier = {
+	.notifier_call = u25_nl_notify,
+};
 
 void add_emcdi_header_to_logs(struct sk_buff *skb, struct nlmsghdr *nlh, int data_len)
 {
@@ -104,41 +228,26 @@ static void nl_recv_msg(struct sk_buff *skb)
 			//dev_kfree_skb(skb);
 		} else
 			printk("Not an emcdi packet nlmsg_type: %d\n", nlh->nlmsg_type);
-	} else if(nlh->nlmsg_type == NL_TYPE_PID) {
-		printk(KERN_INFO "Netlink received msg payload:%s\n", (char *)NLMSG_DATA(nlh));
-		if (!strcmp(NLMSG_DATA(nlh), "MAE")) {
-			pr_info("MAE application\n");
-			pid[0] = nlh->nlmsg_pid;
-		} 
-		if (!strcmp(NLMSG_DATA(nlh), "IPSEC")) {
-			pr_info("IPSEC application\n");
-			pid[1] = nlh->nlmsg_pid;
-		}
-		if (!strcmp(NLMSG_DATA(nlh), "FIREWALL")) {
-			pr_info("FIREWALL application\n");
-			pid[2] = nlh->nlmsg_pid;
-		}
-		if (!strcmp(nlmsg_data(nlh), "IMAGE UPGRADE")) {
-			pr_info("IMAGE UPGRADE Application\n");
-			pid[7] = nlh->nlmsg_pid;
-		}
-		if (!strcmp(NLMSG_DATA(nlh), "CONTROLLER")) {
-                        pr_info("CONTROLLER application\n");
-                        pid[6] = nlh->nlmsg_pid;
-                }
-		if (!strcmp(nlmsg_data(nlh), "FLASH UPGRADE")) {
-                        pr_info("FLASH UPGRADE Application\n");
-                        pid[5] = nlh->nlmsg_pid;
-                }
-		if (!strcmp(NLMSG_DATA(nlh), "QOS_HTB_CONFIG")) {
-			pr_info("QOS_HTB_CONFIG application\n");
-			pid[3] = nlh->nlmsg_pid;
-		}
-		if (!strcmp(NLMSG_DATA(nlh), "LOGS")) {
-                        pr_info("LOGGER application\n");
-                        pid[4] = nlh->nlmsg_pid;
-                }
+	} else if (nlh->nlmsg_type == NL_TYPE_PID ||
+		   nlh->nlmsg_type == NL_TYPE_UNSUB) {
+		int index = u25_nl_type_index(NLMSG_DATA(nlh),
+					      nlh->nlmsg_len - NLMSG_HDRLEN);
 
+		if (index < 0) {
+			pr_info("Unknown application %.*s\n",
+				max_t(int, nlh->nlmsg_len - NLMSG_HDRLEN, 0),
+				(char *)NLMSG_DATA(nlh));
+		} else if (nlh->nlmsg_type == NL_TYPE_UNSUB) {
+			/* The sender's real port, as u25_nl_notify() sees it;
+			 * nlmsg_pid is whatever the sender put there
+			 */
+			u25_nl_unsubscribe(index, NETLINK_CB(skb).portid);
+		} else if (u25_nl_subscribe(index, NETLINK_CB(skb).portid)) {
+			pr_info("%s application: too many subscribers\n",
+				u25_nl_types[index].name);
+		} else {
+			pr_info("%s application\n", u25_nl_types[index].name);
+		}
 	} else if(nlh->nlmsg_type ==  NL_TYPE_LOGS) {
 		skb_pull(skb, NLMSG_HDRLEN);
 		add_emcdi_header_to_logs(skb , nlh,  nlh->nlmsg_len - NLMSG_HDRLEN );
@@ -154,17 +263,23 @@ int u25_netlink_init(void)
 	struct netlink_kernel_cfg cfg = {
 	      	.input = nl_recv_msg,
 	};
+	int ret;
+
 	nl_sk = netlink_kernel_create(&init_net, NETLINK_USER, &cfg);
    	if (!nl_sk) 
 	        return -ENOMEM;
 
-	return 0;
+	ret = netlink_register_notifier(&u25_nl_notifier);
+	if (ret)
+		netlink_kernel_release(nl_sk);
+	return ret;
 
 }
 EXPORT_SYMBOL(u25_netlink_init);
 
 int u25_netlink_exit(void)
 {
+        netlink_unregister_notifier(&u25_nl_notifier);
         netlink_kernel_release(nl_sk);
         return 0;
 }
@@ -14,8 +14,14 @@
 #define NL_TYPE_ACK 3
 #define NL_TYPE_PID 5
 #define NL_TYPE_LOGS 7
+#define NL_TYPE_UNSUB 9
+
+/* Agents that may subscribe to one eMCDI type, e.g. one per A53 core */
+#define U25_NL_MAX_SUBSCRIBERS 8
 
 int u25_netlink_init(void);
 int u25_netlink_exit(void);
+u32 u25_nl_pick_subscriber(int index, u16 seq);
+void u25_nl_unsubscribe(int index, u32 portid);
 
 
@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Shared-memory eMCDI rings between the PS control agents and the driver
+ * Copyright (c) 2021  Xilinx, Inc. All rights reserved.
+ *
+ * See xilinx_axienet_ring.h for the interface seen by the agents.
+ */
+
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "xilinx_axienet_mcdi.h"
+#include "xilinx_axienet_ring.h"
+
+#define U25_RING_AREA_SIZE	(PAGE_SIZE + 2 * U25_RING_N_SLOTS * \
+				 sizeof(struct u25_ring_slot))
+
+/**
+ * struct u25_ring - Ring shared with the agent of one eMCDI type
+ * @lock:	Serialises producers on the rx ring, and @bound and @evfd
+ * @tx_mutex:	Serialises consumers of the tx ring
+ * @ctrl:	The vmalloc_user() area.  Allocated on first bind and freed by
+ *		u25_ring_exit() at module unload; every open file (and so
+ *		every mapping) holds a module reference, so none can outlive it
+ * @rx:		First rx slot, in @ctrl's area
+ * @tx:		First tx slot, in @ctrl's area
+ * @rx_prod:	Our rx producer index
+ * @tx_cons:	Our tx consumer index.  @ctrl is writable by the agent, so
+ *		@rx_prod and @tx_cons are only published there, never read back
+ * @bound:	Whether an agent has this ring open
+ * @evfd:	Optional eventfd signalled for each request
+ * @wq:		Waitqueue for poll()
+ */
+struct u25_ring {
+	spinlock_t lock;
+	struct mutex tx_mutex;
+	struct u25_ring_ctrl *ctrl;
+	struct u25_ring_slot *rx;
+	struct u25_ring_slot *tx;
+	u32 rx_prod;
+	u32 tx_cons;
+	bool bound;
+	struct eventfd_ctx *evfd;
+	wait_queue_head_t wq;
+};
+
+static struct u25_ring u25_rings[U25_RING_MAX_INDEX];
+static DEFINE_MUTEX(u25_ring_bind_mutex);
+/* The device replies are sent on; NULL while no device is probed */
+static struct axienet_local __rcu *u25_ring_lp;
+
+/**
+ * u25_ring_deliver - Hand a request from the host to the agent's ring
+ * @skb:	The eMCDI packet, starting at its emcdi_ethhdr
+ * @qid:	MCDMA queue the packet arrived on
+ * @index:	U25_EMCDI_TYPE_*_INDEX of the agent
+ *
+ * Called from the receive path.  Consumes @skb if the agent has bound a
+ * ring, even if the ring is full.
+ *
+ * Return: false if no ring is bound and the caller should use netlink.
+ */
+bool u25_ring_deliver(struct sk_buff *skb, u8 qid, u8 index)
+{
+	struct u25_ring_slot *slot;
+	struct u25_ring *r;
+	u32 prod;
+
+	if (index >= U25_RING_MAX_INDEX)
+		return false;
+	r = &u25_rings[index];
+
+	spin_lock(&r->lock);
+	if (!r->bound) {
+		spin_unlock(&r->lock);
+		return false;
+	}
+	prod = r->rx_prod;
+	if (prod - READ_ONCE(r->ctrl->rx_cons) >= U25_RING_N_SLOTS ||
+	    skb->len > sizeof(slot->data)) {
+		r->ctrl->rx_dropped++;
+		goto out;
+	}
+	slot = &r->rx[prod & (U25_RING_N_SLOTS - 1)];
+	slot->len = skb->len;
+	slot->qid = qid;
+	skb_copy_bits(skb, 0, slot->data, skb->len);
+	/* Publish the slot before the index */
+	r->rx_prod = prod + 1;
+	smp_store_release(&r->ctrl->rx_prod, r->rx_prod);
+	if (r->evfd)
+		eventfd_signal(r->evfd, 1);
+	wake_up_interruptible(&r->wq);
+out:
+	spin_unlock(&r->lock);
+	dev_kfree_skb_any(skb);
+	return true;
+}
+
+/* Send every reply the agent has posted since the last kick.  That is at
+ * most a ring's worth; a tx_prod further ahead is refused with -EINVAL.
+ */
+static int u25_ring_kick(struct u25_ring *r)
+{
+	struct axienet_local *lp;
+	struct net_device *ndev;
+	struct u25_ring_slot *slot;
+	struct emcdi_ethhdr *hdr;
+	struct sk_buff *skb;
+	u32 cons, prod;
+	int sent = 0;
+	u16 len;
+	u8 qid;
+
+	mutex_lock(&r->tx_mutex);
+	rcu_read_lock();
+	lp = rcu_dereference(u25_ring_lp);
+	if (!lp) {
+		sent = -ENODEV;
+		goto out;
+	}
+	ndev = lp->ndev;
+
+	cons = r->tx_cons;
+	prod = smp_load_acquire(&r->ctrl->tx_prod);
+	if (prod - cons > U25_RING_N_SLOTS) {
+		r->ctrl->tx_bad_kicks++;
+		sent = -EINVAL;
+		goto out;
+	}
+	for (; cons != prod; cons++) {
+		slot = &r->tx[cons & (U25_RING_N_SLOTS - 1)];
+		len = READ_ONCE(slot->len);
+		qid = READ_ONCE(slot->qid);
+		if (len < sizeof(*hdr) || len > sizeof(slot->data) ||
+		    qid >= lp->num_tx_queues) {
+			r->ctrl->tx_dropped++;
+			continue;
+		}
+		skb = netdev_alloc_skb(ndev, len);
+		if (!skb)
+			break;
+		skb_put_data(skb, slot->data, len);
+		hdr = (struct emcdi_ethhdr *)skb->data;
+		if (hdr->h_vlan_encapsulated_proto != htons(ETH_P_802_EX1)) {
+			dev_kfree_skb(skb);
+			r->ctrl->tx_dropped++;
+			continue;
+		}
+		skb->queue_mapping = qid;
+		netif_tx_lock_bh(ndev);
+		if (ndev->netdev_ops->ndo_start_xmit(skb, ndev) != NETDEV_TX_OK) {
+			/* Leave the slot for the next kick */
+			netif_tx_unlock_bh(ndev);
+			dev_kfree_skb(skb);
+			break;
+		}
+		netif_tx_unlock_bh(ndev);
+		sent++;
+	}
+	r->tx_cons = cons;
+	smp_store_release(&r->ctrl->tx_cons, cons);
+out:
+	rcu_read_unlock();
+	mutex_unlock(&r->tx_mutex);
+
+	return sent;
+}
+
+static int u25_ring_bind(struct file *file, u32 index)
+{
+	struct u25_ring *r;
+	int rc = 0;
+
+	if (index >= U25_RING_MAX_INDEX)
+		return -EINVAL;
+	if (file->private_data)
+		return -EBUSY;
+	r = &u25_rings[index];
+
+	mutex_lock(&u25_ring_bind_mutex);
+	if (r->bound) {
+		rc = -EBUSY;
+		goto out;
+	}
+	if (!r->ctrl) {
+		r->ctrl = vmalloc_user(U25_RING_AREA_SIZE);
+		if (!r->ctrl) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		r->rx = (struct u25_ring_slot *)((u8 *)r->ctrl + PAGE_SIZE);
+		r->tx = r->rx + U25_RING_N_SLOTS;
+	}
+	memset(r->ctrl, 0, sizeof(*r->ctrl));
+	r->rx_prod = 0;
+	r->tx_cons = 0;
+	r->ctrl->n_slots = U25_RING_N_SLOTS;
+	r->ctrl->slot_size = sizeof(struct u25_ring_slot);
+
+	spin_lock_bh(&r->lock);
+	r->bound = true;
+	spin_unlock_bh(&r->lock);
+	file->private_data = r;
+	pr_info("%s: agent bound to eMCDI index %u\n", __func__, index);
+out:
+	mutex_unlock(&u25_ring_bind_mutex);
+	return rc;
+}
+
+static int u25_ring_set_eventfd(struct u25_ring *r, int fd)
+{
+	struct eventfd_ctx *evfd = NULL, *old;
+
+	if (fd >= 0) {
+		evfd = eventfd_ctx_fdget(fd);
+		if (IS_ERR(evfd))
+			return PTR_ERR(evfd);
+	}
+	spin_lock_bh(&r->lock);
+	old = r->evfd;
+	r->evfd = evfd;
+	spin_unlock_bh(&r->lock);
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+static long u25_ring_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct u25_ring *r = file->private_data;
+	u32 index;
+	s32 fd;
+
+	switch (cmd) {
+	case U25_RING_IOC_BIND:
+		if (get_user(index, (u32 __user *)arg))
+			return -EFAULT;
+		return u25_ring_bind(file, index);
+	case U25_RING_IOC_EVENTFD:
+		if (!r)
+			return -ENXIO;
+		if (get_user(fd, (s32 __user *)arg))
+			return -EFAULT;
+		return u25_ring_set_eventfd(r, fd);
+	case U25_RING_IOC_KICK:
+		if (!r)
+			return -ENXIO;
+		return u25_ring_kick(r);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int u25_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct u25_ring *r = file->private_data;
+
+	if (!r)
+		return -ENXIO;
+	return remap_vmalloc_range(vma, r->ctrl, vma->vm_pgoff);
+}
+
+static __poll_t u25_ring_poll(struct file *file, poll_table *wait)
+{
+	struct u25_ring *r = file->private_data;
+	__poll_t mask = 0;
+
+	if (!r)
+		return EPOLLERR;
+	poll_wait(file, &r->wq, wait);
+	if (READ_ONCE(r->rx_prod) != READ_ONCE(r->ctrl->rx_cons))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (READ_ONCE(r->ctrl->tx_prod) - READ_ONCE(r->tx_cons) < U25_RING_N_SLOTS)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+static int u25_ring_release(struct inode *inode, struct file *file)
+{
+	struct u25_ring *r = file->private_data;
+
+	if (!r)
+		return 0;
+	u25_ring_set_eventfd(r, -1);
+	mutex_lock(&u25_ring_bind_mutex);
+	spin_lock_bh(&r->lock);
+	r->bound = false;
+	spin_unlock_bh(&r->lock);
+	mutex_unlock(&u25_ring_bind_mutex);
+	return 0;
+}
+
+static const struct file_operations u25_ring_fops = {
+	.owner		= THIS_MODULE,
+	.unlocked_ioctl	= u25_ring_ioctl,
+	.mmap		= u25_ring_mmap,
+	.poll		= u25_ring_poll,
+	.release	= u25_ring_release,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice u25_ring_miscdev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= U25_RING_DEV_NAME,
+	.fops	= &u25_ring_fops,
+};
+
+/* Called from probe once @lp can transmit */
+void u25_ring_attach(struct axienet_local *lp)
+{
+	rcu_assign_pointer(u25_ring_lp, lp);
+}
+
+/* Called from remove before @lp goes away.  Agents stay bound and keep
+ * their mappings; U25_RING_IOC_KICK fails with -ENODEV until a device is
+ * probed again.
+ */
+void u25_ring_detach(void)
+{
+	RCU_INIT_POINTER(u25_ring_lp, NULL);
+	/* Wait for kicks still sending on the old device */
+	synchronize_rcu();
+}
+
+/* Called at module load, before any device is probed */
+int u25_ring_init(void)
+{
+	int i;
+
+	for (i = 0; i < U25_RING_MAX_INDEX; i++) {
+		spin_lock_init(&u25_rings[i].lock);
+		mutex_init(&u25_rings[i].tx_mutex);
+		init_waitqueue_head(&u25_rings[i].wq);
+	}
+	return misc_register(&u25_ring_miscdev);
+}
+
+/* Called at module unload.  No file can be open: each holds a module
+ * reference through u25_ring_fops.owner, and deregistering the device
+ * stops new opens.
+ */
+void u25_ring_exit(void)
+{
+	int i;
+
+	misc_deregister(&u25_ring_miscdev);
+	for (i = 0; i < U25_RING_MAX_INDEX; i++) {
+		vfree(u25_rings[i].ctrl);
+		u25_rings[i].ctrl = NULL;
+	}
+}
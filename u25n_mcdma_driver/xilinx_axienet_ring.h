@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Shared-memory eMCDI rings between the PS control agents and the driver
+ * Copyright (c) 2021  Xilinx, Inc. All rights reserved.
+ *
+ * An agent opens /dev/u25_emcdi, binds it to the eMCDI type index it serves
+ * (U25_EMCDI_TYPE_*_INDEX), mmap()s the ring area and then consumes requests
+ * from the rx ring and posts replies to the tx ring.  poll() or an eventfd
+ * signals new requests; U25_RING_IOC_KICK sends all posted replies at once.
+ * Agents that do not bind keep using the netlink socket.
+ */
+#ifndef XILINX_AXIENET_RING_H
+#define XILINX_AXIENET_RING_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define U25_RING_DEV_NAME	"u25_emcdi"
+#define U25_RING_MAX_INDEX	8	/* U25_EMCDI_N_INDEX */
+#define U25_RING_N_SLOTS	64	/* per direction, power of 2 */
+#define U25_RING_SLOT_SIZE	2048
+
+/* The mmap()ed area is one page holding struct u25_ring_ctrl, followed by
+ * U25_RING_N_SLOTS rx slots (driver to agent) and U25_RING_N_SLOTS tx slots
+ * (agent to driver).  Indices run freely and are masked by the reader.
+ */
+struct u25_ring_ctrl {
+	__u32	rx_prod;	/* written by the driver */
+	__u32	rx_cons;	/* written by the agent */
+	__u32	tx_prod;	/* written by the agent */
+	__u32	tx_cons;	/* written by the driver */
+	__u32	n_slots;
+	__u32	slot_size;
+	__u32	rx_dropped;	/* requests lost to a full rx ring */
+	__u32	tx_dropped;	/* malformed replies */
+	__u32	tx_bad_kicks;	/* kicks refused for a bogus tx_prod */
+};
+
+struct u25_ring_slot {
+	__u16	len;		/* bytes of data[], from the emcdi_ethhdr on */
+	__u8	qid;		/* MCDMA queue of the request / for the reply */
+	__u8	rsvd;
+	__u8	data[U25_RING_SLOT_SIZE - 4];
+};
+
+#define U25_RING_IOC_MAGIC	'U'
+#define U25_RING_IOC_BIND	_IOW(U25_RING_IOC_MAGIC, 1, __u32)
+#define U25_RING_IOC_EVENTFD	_IOW(U25_RING_IOC_MAGIC, 2, __s32)
+#define U25_RING_IOC_KICK	_IO(U25_RING_IOC_MAGIC, 3)
+
+#ifdef __KERNEL__
+struct sk_buff;
+struct axienet_local;
+
+int u25_ring_init(void);
+void u25_ring_exit(void);
+void u25_ring_attach(struct axienet_local *lp);
+void u25_ring_detach(void);
+bool u25_ring_deliver(struct sk_buff *skb, u8 qid, u8 index);
+#endif
+
+#endif /* XILINX_AXIENET_RING_H */